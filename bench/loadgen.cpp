@@ -0,0 +1,459 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-02
+ * @copyleft Apache 2.0
+ */
+/* 基于epoll的多线程压测工具
+ * 和webbench每个客户端fork一个进程、每个请求一条短连接不同，
+ * 这里每个线程一个epoll，连接保持打开(keep-alive)，可以流水线发送请求，
+ * 最后输出吞吐量和p50/p99/p999延迟 */
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <memory>
+
+#include "../code/metrics/metrics.h"
+
+using namespace std;
+
+// 压测场景，对应resources/下自带的资源
+struct Scenario {
+    const char* name;
+    const char* method;
+    const char* path;
+    const char* body;   // 为nullptr表示没有请求体
+    const char* desc;
+};
+
+static const Scenario SCENARIOS[] = {
+    { "small", "GET", "/index.html", nullptr, "small html page (~3KB)" },
+    { "font", "GET", "/fonts/fontawesome-webfont.ttf", nullptr, "large font file (~140KB)" },
+    { "image", "GET", "/images/instagram-image4.jpg", nullptr, "jpeg image (~100KB)" },
+    { "login", "POST", "/login", "username=bench&password=bench",
+        "form login, run the server with --sql_stub or a MySQL with the user table" },
+    { "stats", "GET", "/__stats", nullptr, "metrics endpoint" },
+};
+
+struct Options {
+    string host = "127.0.0.1";
+    int port = 1316;
+    int connections = 100;
+    int threads = 4;
+    int duration = 10;      // 秒
+    int pipeline = 1;       // 每个连接同时在途的请求数
+    bool keepAlive = true;
+    bool json = false;
+    string method = "GET";
+    string path = "/index.html";
+    string body;
+    string scenario = "small";
+};
+
+// 每个线程自己的统计，结束后再合并
+struct Stats {
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    uint64_t non2xx = 0;
+    uint64_t connectErrors = 0;
+    uint64_t readErrors = 0;
+    uint64_t reconnects = 0;
+    unique_ptr<Histogram> latency{new Histogram()};  // 单位微秒
+};
+
+struct Conn {
+    int fd = -1;
+    string out;             // 还没发完的请求
+    size_t sent = 0;        // out中已经发出去的字节
+    string header;          // 正在解析的响应头
+    size_t bodyLeft = 0;    // 当前响应还剩多少body没读
+    bool inBody = false;
+    bool closeAfter = false;    // 服务器要求关闭连接
+    int status = 0;
+    uint64_t done = 0;          // 这条连接上完成的响应数
+    deque<uint64_t> starts;     // 在途请求的发送时间
+};
+
+static volatile sig_atomic_t stop = 0;
+
+static string BuildRequest(const Options& opt) {
+    string req = opt.method + " " + opt.path + " HTTP/1.1\r\n";
+    req += "Host: " + opt.host + ":" + to_string(opt.port) + "\r\n";
+    req += opt.keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    if(!opt.body.empty()) {
+        req += "Content-Type: application/x-www-form-urlencoded\r\n";
+        req += "Content-Length: " + to_string(opt.body.size()) + "\r\n";
+    }
+    req += "\r\n";
+    req += opt.body;
+    return req;
+}
+
+class Worker {
+public:
+    Worker(const Options& opt, int connections, sockaddr_in addr)
+        : opt_(opt), conns_(connections), addr_(addr), request_(BuildRequest(opt)) {}
+
+    void Run(uint64_t deadlineUs);
+    Stats& GetStats() { return stats_; }
+
+private:
+    bool Connect_(Conn& c);
+    void Close_(Conn& c);
+    void Fill_(Conn& c);
+    bool Flush_(Conn& c);
+    bool OnReadable_(Conn& c, char* buf, size_t bufLen);
+    bool Consume_(Conn& c, const char* p, size_t n);
+    void Update_(Conn& c);
+
+    const Options& opt_;
+    vector<Conn> conns_;
+    sockaddr_in addr_;
+    string request_;
+    int epfd_ = -1;
+    Stats stats_;
+};
+
+bool Worker::Connect_(Conn& c) {
+    c = Conn();
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(c.fd < 0) {
+        stats_.connectErrors++;
+        return false;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(c.fd, (sockaddr*)&addr_, sizeof(addr_)) < 0 && errno != EINPROGRESS) {
+        stats_.connectErrors++;
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = &c;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+    Fill_(c);
+    return true;
+}
+
+void Worker::Close_(Conn& c) {
+    if(c.fd >= 0) {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        c.fd = -1;
+    }
+}
+
+// 补足流水线深度
+void Worker::Fill_(Conn& c) {
+    while(static_cast<int>(c.starts.size()) < opt_.pipeline) {
+        c.out += request_;
+        c.starts.push_back(Metrics::NowUs());
+        if(!opt_.keepAlive) { break; }
+    }
+}
+
+bool Worker::Flush_(Conn& c) {
+    while(c.sent < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EAGAIN) { return true; }
+            return false;
+        }
+        c.sent += n;
+    }
+    c.out.clear();
+    c.sent = 0;
+    return true;
+}
+
+// 只关心是否要写
+void Worker::Update_(Conn& c) {
+    epoll_event ev = {0};
+    ev.events = EPOLLIN | (c.out.empty() ? 0 : EPOLLOUT);
+    ev.data.ptr = &c;
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+// 解析响应，body不拷贝只计数
+bool Worker::Consume_(Conn& c, const char* p, size_t n) {
+    while(n > 0) {
+        if(c.inBody) {
+            size_t take = n < c.bodyLeft ? n : c.bodyLeft;
+            c.bodyLeft -= take;
+            p += take;
+            n -= take;
+        } else {
+            size_t old = c.header.size();
+            c.header.append(p, n);
+            size_t end = c.header.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if(end == string::npos) { return true; }
+            size_t used = end + 4 - old;
+            p += used;
+            n -= used;
+            c.header.resize(end + 2);
+            // HTTP/1.1 200 OK
+            c.status = c.header.size() > 12 ? atoi(c.header.c_str() + 9) : 0;
+            c.bodyLeft = 0;
+            c.closeAfter = !opt_.keepAlive;
+            size_t pos = 0;
+            while((pos = c.header.find("\r\n", pos)) != string::npos) {
+                const char* line = c.header.c_str() + pos + 2;
+                if(strncasecmp(line, "Content-length:", 15) == 0) {
+                    c.bodyLeft = strtoul(line + 15, nullptr, 10);
+                } else if(strncasecmp(line, "Connection: close", 17) == 0) {
+                    c.closeAfter = true;
+                }
+                pos += 2;
+            }
+            c.header.clear();
+            c.inBody = true;
+        }
+        if(c.inBody && c.bodyLeft == 0) {
+            // 一个完整的响应
+            c.inBody = false;
+            stats_.requests++;
+            c.done++;
+            if(c.status < 200 || c.status >= 300) { stats_.non2xx++; }
+            if(!c.starts.empty()) {
+                stats_.latency->Record(Metrics::NowUs() - c.starts.front());
+                c.starts.pop_front();
+            }
+            if(c.closeAfter) { return false; }
+            if(!stop) { Fill_(c); }
+        }
+    }
+    return true;
+}
+
+bool Worker::OnReadable_(Conn& c, char* buf, size_t bufLen) {
+    while(true) {
+        ssize_t n = recv(c.fd, buf, bufLen, 0);
+        if(n > 0) {
+            stats_.bytes += n;
+            if(!Consume_(c, buf, n)) { return false; }
+            continue;
+        }
+        if(n < 0 && errno == EAGAIN) { return true; }
+        // 服务器在还有请求在途时关闭了连接
+        if(!c.starts.empty()) { stats_.readErrors++; }
+        return false;
+    }
+}
+
+void Worker::Run(uint64_t deadlineUs) {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    for(auto& c: conns_) { Connect_(c); }
+    vector<epoll_event> events(conns_.size() + 1);
+    vector<char> buf(256 * 1024);
+
+    while(!stop && Metrics::NowUs() < deadlineUs) {
+        int n = epoll_wait(epfd_, events.data(), events.size(), 100);
+        for(int i = 0; i < n; i++) {
+            Conn& c = *static_cast<Conn*>(events[i].data.ptr);
+            bool ok = true;
+            if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                OnReadable_(c, buf.data(), buf.size());
+                ok = false;
+            } else {
+                if(events[i].events & EPOLLIN) {
+                    ok = OnReadable_(c, buf.data(), buf.size());
+                }
+                if(ok && (events[i].events & EPOLLOUT)) {
+                    ok = Flush_(c);
+                }
+            }
+            if(!ok) {
+                Close_(c);
+                // 一个响应都没有拿到就断开了，多半是连不上，不再重连
+                if(c.done == 0) {
+                    stats_.connectErrors++;
+                    continue;
+                }
+                // 短连接模式或者服务器关闭了连接，重新连接
+                stats_.reconnects++;
+                if(!stop && Metrics::NowUs() < deadlineUs) { Connect_(c); }
+                continue;
+            }
+            if(!c.out.empty()) { Flush_(c); }
+            Update_(c);
+        }
+    }
+    for(auto& c: conns_) { Close_(c); }
+    close(epfd_);
+}
+
+// 根据直方图的桶算分位数，返回毫秒
+static double Percentile(const vector<uint64_t>& counts, uint64_t total, double q) {
+    if(total == 0) { return 0; }
+    uint64_t rank = static_cast<uint64_t>(q * total);
+    if(rank >= total) { rank = total - 1; }
+    uint64_t seen = 0;
+    for(int b = 0; b < Histogram::BUCKETS; b++) {
+        seen += counts[b];
+        if(seen > rank) { return Histogram::UpperOf(b) / 1000.0; }
+    }
+    return Histogram::UpperOf(Histogram::BUCKETS - 1) / 1000.0;
+}
+
+static void Usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -H host        server address (default 127.0.0.1)\n"
+        "  -p port        server port (default 1316)\n"
+        "  -c conns       open connections (default 100)\n"
+        "  -t threads     worker threads, one epoll each (default 4)\n"
+        "  -d seconds     test duration (default 10)\n"
+        "  -P depth       pipelined requests per connection (default 1)\n"
+        "  -s scenario    built-in scenario (default small)\n"
+        "  -u path        request path, overrides the scenario\n"
+        "  -b body        POST this form body to -u path\n"
+        "  -C             close the connection after every response\n"
+        "  -j             print one JSON line instead of the report\n"
+        "scenarios:\n", prog);
+    for(auto& s: SCENARIOS) {
+        fprintf(stderr, "  %-8s %s %s  %s\n", s.name, s.method, s.path, s.desc);
+    }
+}
+
+static bool ParseArgs(int argc, char* argv[], Options& opt) {
+    string path, body;
+    int ch;
+    while((ch = getopt(argc, argv, "H:p:c:t:d:P:s:u:b:Cjh")) != -1) {
+        switch(ch) {
+        case 'H': opt.host = optarg; break;
+        case 'p': opt.port = atoi(optarg); break;
+        case 'c': opt.connections = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'd': opt.duration = atoi(optarg); break;
+        case 'P': opt.pipeline = atoi(optarg); break;
+        case 's': opt.scenario = optarg; break;
+        case 'u': path = optarg; break;
+        case 'b': body = optarg; break;
+        case 'C': opt.keepAlive = false; break;
+        case 'j': opt.json = true; break;
+        default: return false;
+        }
+    }
+    if(opt.connections <= 0 || opt.threads <= 0 || opt.duration <= 0 || opt.pipeline <= 0) {
+        return false;
+    }
+    if(opt.threads > opt.connections) { opt.threads = opt.connections; }
+    if(!path.empty()) {
+        opt.scenario = "custom";
+        opt.path = path;
+        opt.body = body;
+        opt.method = body.empty() ? "GET" : "POST";
+        return true;
+    }
+    for(auto& s: SCENARIOS) {
+        if(opt.scenario == s.name) {
+            opt.method = s.method;
+            opt.path = s.path;
+            opt.body = s.body ? s.body : "";
+            return true;
+        }
+    }
+    fprintf(stderr, "unknown scenario: %s\n", opt.scenario.c_str());
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if(!ParseArgs(argc, argv, opt)) {
+        Usage(argv[0]);
+        return 2;
+    }
+    sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    if(inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "bad host: %s\n", opt.host.c_str());
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, [](int) { stop = 1; });
+
+    vector<unique_ptr<Worker>> workers;
+    for(int i = 0; i < opt.threads; i++) {
+        int n = opt.connections / opt.threads + (i < opt.connections % opt.threads ? 1 : 0);
+        workers.emplace_back(new Worker(opt, n, addr));
+    }
+    uint64_t begin = Metrics::NowUs();
+    uint64_t deadline = begin + opt.duration * 1000000ULL;
+    vector<thread> threads;
+    for(auto& w: workers) {
+        threads.emplace_back([&w, deadline] { w->Run(deadline); });
+    }
+    for(auto& t: threads) { t.join(); }
+    double secs = (Metrics::NowUs() - begin) / 1e6;
+
+    Stats total;
+    vector<uint64_t> counts;
+    uint64_t sum = 0;
+    for(auto& w: workers) {
+        Stats& s = w->GetStats();
+        total.requests += s.requests;
+        total.bytes += s.bytes;
+        total.non2xx += s.non2xx;
+        total.connectErrors += s.connectErrors;
+        total.readErrors += s.readErrors;
+        total.reconnects += s.reconnects;
+        s.latency->MergeTo(counts, sum);
+    }
+    uint64_t samples = 0;
+    double maxMs = 0;
+    for(int b = 0; b < Histogram::BUCKETS; b++) {
+        samples += counts[b];
+        if(counts[b]) { maxMs = Histogram::UpperOf(b) / 1000.0; }
+    }
+    double rps = total.requests / secs;
+    double mbps = total.bytes / secs / (1024 * 1024);
+    double avgMs = samples ? sum / 1000.0 / samples : 0;
+    double p50 = Percentile(counts, samples, 0.5);
+    double p90 = Percentile(counts, samples, 0.9);
+    double p99 = Percentile(counts, samples, 0.99);
+    double p999 = Percentile(counts, samples, 0.999);
+
+    if(opt.json) {
+        printf("{\"scenario\":\"%s\",\"path\":\"%s\",\"connections\":%d,\"threads\":%d,"
+               "\"pipeline\":%d,\"keepalive\":%s,\"seconds\":%.3f,\"requests\":%lu,"
+               "\"rps\":%.1f,\"mbps\":%.2f,\"non2xx\":%lu,\"connect_errors\":%lu,"
+               "\"read_errors\":%lu,\"reconnects\":%lu,\"avg_ms\":%.3f,\"p50_ms\":%.3f,"
+               "\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"max_ms\":%.3f}\n",
+               opt.scenario.c_str(), opt.path.c_str(), opt.connections, opt.threads,
+               opt.pipeline, opt.keepAlive ? "true" : "false", secs,
+               (unsigned long)total.requests, rps, mbps, (unsigned long)total.non2xx,
+               (unsigned long)total.connectErrors, (unsigned long)total.readErrors,
+               (unsigned long)total.reconnects, avgMs, p50, p90, p99, p999, maxMs);
+        return 0;
+    }
+    printf("%s %s http://%s:%d%s\n", opt.scenario.c_str(), opt.method.c_str(),
+            opt.host.c_str(), opt.port, opt.path.c_str());
+    printf("  %d connections, %d threads, pipeline %d, %s, %.2fs\n", opt.connections,
+            opt.threads, opt.pipeline, opt.keepAlive ? "keep-alive" : "close", secs);
+    printf("  requests: %lu  non-2xx: %lu  connect errors: %lu  read errors: %lu  reconnects: %lu\n",
+            (unsigned long)total.requests, (unsigned long)total.non2xx,
+            (unsigned long)total.connectErrors, (unsigned long)total.readErrors,
+            (unsigned long)total.reconnects);
+    printf("  throughput: %.1f req/s  %.2f MB/s\n", rps, mbps);
+    printf("  latency(ms): avg %.3f  p50 %.3f  p90 %.3f  p99 %.3f  p999 %.3f  max %.3f\n",
+            avgMs, p50, p90, p99, p999, maxMs);
+    return 0;
+}
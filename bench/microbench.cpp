@@ -0,0 +1,389 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-02
+ * @copyleft Apache 2.0
+ */
+/* 核心组件的微基准：Buffer、HttpRequest、HttpResponse、HeapTimer、ThreadPool、Log
+ * 和loadgen测整个服务器不同，这里单独测每个组件，改动前后各跑一次，用JSON对比：
+ *     ./bin/microbench --benchmark_out=before.json
+ *     ./bin/microbench --benchmark_filter=Parse --benchmark_format=json */
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <random>
+
+#include "microbench.h"
+#include "../code/buffer/buffer.h"
+#include "../code/buffer/arena.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/httpresponse.h"
+#include "../code/http/filecache.h"
+#include "../code/http/staticimage.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/pool/threadpool.h"
+#include "../code/log/log.h"
+
+using namespace std;
+
+namespace {
+
+// 浏览器发出的典型请求头
+const char REQUEST[] =
+    "GET /images/instagram-image4.jpg?v=3 HTTP/1.1\r\n"
+    "Host: 127.0.0.1:1316\r\n"
+    "Connection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/84.0.4147.89 Safari/537.36\r\n"
+    "Accept: image/webp,image/apng,image/*,*/*;q=0.8\r\n"
+    "Referer: http://127.0.0.1:1316/picture\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1593000000; session=0123456789abcdef0123456789abcdef\r\n"
+    "If-Modified-Since: Sat, 27 Jun 2020 08:00:00 GMT\r\n"
+    "\r\n";
+
+// 测试用的资源目录，第一次用到时在/tmp下建，进程退出时删掉
+class Resources {
+public:
+    static Resources& Instance() {
+        static Resources inst;
+        return inst;
+    }
+    const string& Dir() const { return dir_; }
+
+    // 保证有count个小文件/f0.html ... /f{count-1}.html
+    void EnsureFiles(int count) {
+        string body(3000, 'x');
+        for(; files_ < count; files_++) {
+            Write_("/f" + to_string(files_) + ".html", body);
+        }
+    }
+
+private:
+    Resources() {
+        char tmpl[] = "/tmp/microbench-XXXXXX";
+        dir_ = mkdtemp(tmpl) ? tmpl : "/tmp";
+        Write_("/index.html", string(3000, 'x'));
+        Write_("/404.html", "<html><body>404</body></html>");
+        Write_("/400.html", "<html><body>400</body></html>");
+        Write_("/403.html", "<html><body>403</body></html>");
+    }
+    ~Resources() {
+        string cmd = "rm -rf '" + dir_ + "'";
+        if(dir_ != "/tmp" && system(cmd.c_str()) != 0) {}
+    }
+    void Write_(const string& name, const string& body) {
+        int fd = open((dir_ + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) { return; }
+        if(write(fd, body.data(), body.size()) < 0) {}
+        close(fd);
+    }
+
+    string dir_;
+    int files_ = 0;
+};
+
+} // namespace
+
+/* Buffer */
+
+static void BM_BufferAppend(mb::State& state) {
+    Buffer buff;
+    string chunk(state.range(0), 'a');
+    for(auto _ : state) {
+        buff.Append(chunk.data(), chunk.size());
+        // 像连接一样写满一批就取走，容量稳定下来以后不再分配
+        if(buff.ReadableBytes() >= 64 * 1024) { buff.RetrieveAll(); }
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_BufferAppend)->Arg(16)->Arg(256)->Arg(4096);
+
+// socketpair的一端写range(0)个字节，另一端ReadFd读出来，写的时间不计
+static void BM_BufferReadFd(mb::State& state) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        state.SkipWithError("socketpair failed");
+        return;
+    }
+    int size = 1 << 20;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    string chunk(state.range(0), 'a');
+    Buffer buff;
+    int err = 0;
+    for(auto _ : state) {
+        state.PauseTiming();
+        if(write(fds[0], chunk.data(), chunk.size()) < 0) {}
+        state.ResumeTiming();
+        size_t got = 0;
+        while(got < chunk.size()) {
+            ssize_t len = buff.ReadFd(fds[1], &err, chunk.size());
+            if(len <= 0) { break; }
+            got += len;
+        }
+        buff.RetrieveAll();
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+    close(fds[0]);
+    close(fds[1]);
+}
+BENCHMARK(BM_BufferReadFd)->Arg(512)->Arg(16 * 1024);
+
+/* HttpRequest */
+
+// 一个完整的请求一次到齐
+static void BM_ParseRequest(mb::State& state) {
+    Arena arena;
+    HttpRequest request(&arena);
+    Buffer buff;
+    for(auto _ : state) {
+        buff.Append(REQUEST, sizeof(REQUEST) - 1);
+        HttpRequest::HTTP_CODE ret = request.parse(buff);
+        mb::DoNotOptimize(ret);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * (sizeof(REQUEST) - 1));
+}
+BENCHMARK(BM_ParseRequest);
+
+// 请求分成range(0)字节的小段陆续到达，每到一段调用一次parse
+static void BM_ParseRequestFragmented(mb::State& state) {
+    Arena arena;
+    HttpRequest request(&arena);
+    Buffer buff;
+    size_t step = state.range(0);
+    for(auto _ : state) {
+        HttpRequest::HTTP_CODE ret = HttpRequest::NO_REQUEST;
+        for(size_t off = 0; off < sizeof(REQUEST) - 1; off += step) {
+            buff.Append(REQUEST + off, min(step, sizeof(REQUEST) - 1 - off));
+            ret = request.parse(buff);
+        }
+        mb::DoNotOptimize(ret);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ParseRequestFragmented)->Arg(1)->Arg(16)->Arg(128);
+
+// 缓冲区里有range(0)个流水线请求，一次解析完
+static void BM_ParseRequestPipelined(mb::State& state) {
+    Arena arena;
+    HttpRequest request(&arena);
+    Buffer buff;
+    string batch;
+    for(int i = 0; i < state.range(0); i++) { batch += REQUEST; }
+    for(auto _ : state) {
+        buff.Append(batch);
+        while(buff.ReadableBytes() > 0) {
+            HttpRequest::HTTP_CODE ret = request.parse(buff);
+            mb::DoNotOptimize(ret);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ParseRequestPipelined)->Arg(8)->Arg(64);
+
+/* HttpResponse */
+
+// 同一个文件反复请求，stat和open都命中内核缓存
+static void BM_MakeResponseHot(mb::State& state) {
+    const string& dir = Resources::Instance().Dir();
+    HttpResponse response;
+    Buffer buff;
+    for(auto _ : state) {
+        response.Init(dir, "/index.html", true, 200);
+        response.MakeResponse(buff);
+        response.CloseFile();
+        buff.RetrieveAll();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MakeResponseHot);
+
+// 轮流请求range(0)个不同的文件，文件多时目录项和inode缓存的局部性变差
+static void BM_MakeResponseManyFiles(mb::State& state) {
+    int count = state.range(0);
+    Resources::Instance().EnsureFiles(count);
+    const string& dir = Resources::Instance().Dir();
+    vector<string> paths;
+    for(int i = 0; i < count; i++) { paths.push_back("/f" + to_string(i) + ".html"); }
+    HttpResponse response;
+    Buffer buff;
+    size_t i = 0;
+    for(auto _ : state) {
+        response.Init(dir, paths[i++ % paths.size()], true, 200);
+        response.MakeResponse(buff);
+        response.CloseFile();
+        buff.RetrieveAll();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MakeResponseManyFiles)->Arg(1000)->Arg(10000);
+
+// 文件不存在，走404页面
+static void BM_MakeResponseMissing(mb::State& state) {
+    const string& dir = Resources::Instance().Dir();
+    HttpResponse response;
+    Buffer buff;
+    for(auto _ : state) {
+        response.Init(dir, "/no-such-file.html", true, 200);
+        response.MakeResponse(buff);
+        response.CloseFile();
+        buff.RetrieveAll();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MakeResponseMissing);
+
+// 打开文件缓存以后的同样两种情况，命中时没有stat和open
+static void BM_MakeResponseCached(mb::State& state) {
+    const string& dir = Resources::Instance().Dir();
+    const char* path = state.range(0) ? "/index.html" : "/no-such-file.html";
+    FileCache::Instance()->Init(1024, 0);
+    HttpResponse response;
+    Buffer buff;
+    for(auto _ : state) {
+        response.Init(dir, path, true, 200);
+        response.MakeResponse(buff);
+        response.CloseFile();
+        buff.RetrieveAll();
+    }
+    FileCache::Instance()->Init(0, 0);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MakeResponseCached)->Arg(1)->Arg(0);
+
+// 命中预加载镜像，响应头直接拷贝，内容作为内存段入队
+static void BM_MakeResponsePreloaded(mb::State& state) {
+    const string& dir = Resources::Instance().Dir();
+    StaticImage::Swap(StaticImage::Build(dir, StaticImage::Options()));
+    HttpResponse response;
+    Buffer buff;
+    WriteQueue queue;
+    for(auto _ : state) {
+        response.Init(dir, "/index.html", true, 200);
+        response.MakeResponse(buff);
+        response.QueueFile(queue);
+        queue.Clear();
+        buff.RetrieveAll();
+    }
+    StaticImage::Swap(nullptr);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MakeResponsePreloaded);
+
+/* HeapTimer */
+
+// 每次迭代加range(0)个超时时间随机的定时器，清空的时间不计
+static void BM_HeapTimerAdd(mb::State& state) {
+    int n = state.range(0);
+    mt19937 rng(1);
+    vector<int> timeouts(n);
+    for(auto& t: timeouts) { t = 1000 + rng() % 60000; }
+    HeapTimer timer;
+    for(auto _ : state) {
+        for(int id = 0; id < n; id++) {
+            timer.add(id, timeouts[id], nullptr);
+        }
+        state.PauseTiming();
+        timer.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_HeapTimerAdd)->Arg(10000)->Arg(100000)->Arg(1000000);
+
+// 已经有range(0)个定时器，随机挑一个延长超时，相当于连接上来了一个请求
+static void BM_HeapTimerAdjust(mb::State& state) {
+    int n = state.range(0);
+    HeapTimer timer;
+    for(int id = 0; id < n; id++) { timer.add(id, 60000 + id % 1000, nullptr); }
+    mt19937 rng(1);
+    vector<int> ids(4096);
+    for(auto& id: ids) { id = rng() % n; }
+    int timeout = 60000;
+    size_t i = 0;
+    for(auto _ : state) {
+        // 超时时间一直往后推，和真实的连接一样，节点往堆底下沉
+        timer.adjust(ids[i++ & 4095], ++timeout);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HeapTimerAdjust)->Arg(10000)->Arg(100000)->Arg(1000000);
+
+// range(0)个定时器全部已经超时，一次tick处理完
+static void BM_HeapTimerTick(mb::State& state) {
+    int n = state.range(0);
+    HeapTimer timer;
+    int64_t fired = 0;
+    TimeoutCallBack cb = [&fired] { fired++; };
+    for(auto _ : state) {
+        state.PauseTiming();
+        for(int id = 0; id < n; id++) { timer.add(id, 0, cb); }
+        state.ResumeTiming();
+        timer.tick();
+    }
+    mb::DoNotOptimize(fired);
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_HeapTimerTick)->Arg(10000)->Arg(100000)->Arg(1000000);
+
+/* ThreadPool */
+
+// range(0)个工作线程，每次迭代提交一批空任务并等它们执行完
+static void BM_ThreadPoolThroughput(mb::State& state) {
+    const int BATCH = 1000;
+    ThreadPool pool(state.range(0));
+    mutex mtx;
+    condition_variable cond;
+    int done = 0;
+    for(auto _ : state) {
+        {
+            lock_guard<mutex> locker(mtx);
+            done = 0;
+        }
+        for(int i = 0; i < BATCH; i++) {
+            pool.AddTask([&] {
+                lock_guard<mutex> locker(mtx);
+                if(++done == BATCH) { cond.notify_one(); }
+            });
+        }
+        unique_lock<mutex> locker(mtx);
+        cond.wait(locker, [&] { return done == BATCH; });
+    }
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+BENCHMARK(BM_ThreadPoolThroughput)->Arg(1)->Arg(4)->Arg(8);
+
+/* Log，放在最后，打开日志以后前面那些组件里的LOG_DEBUG也要多判断一次级别 */
+
+static string LogDir() {
+    return Resources::Instance().Dir() + "/log";
+}
+
+// 同步写，每一行都在调用线程里写文件
+static void BM_LogWriteSync(mb::State& state) {
+    for(auto _ : state) {
+        LOG_INFO("Client[%d](%s:%d) in, userCount:%d", 12, "127.0.0.1", 54321, 100);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LogWriteSync)->Threads(1)->Threads(4)->Setup([](const mb::State&) {
+    Log::Instance()->init(1, LogDir().c_str(), ".log", 0, 64 << 20);
+});
+
+// 异步写，队列满了丢掉新的行，测的是请求线程自己的开销
+static void BM_LogWriteAsync(mb::State& state) {
+    for(auto _ : state) {
+        LOG_INFO("Client[%d](%s:%d) in, userCount:%d", 12, "127.0.0.1", 54321, 100);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LogWriteAsync)->Threads(1)->Threads(4)->Threads(8)->Setup([](const mb::State&) {
+    Log::Instance()->init(1, LogDir().c_str(), ".log", 1024, 64 << 20);
+});
+
+BENCHMARK_MAIN()
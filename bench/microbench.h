@@ -0,0 +1,440 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-07-02
+ * @copyleft Apache 2.0
+ */
+/* 仿Google Benchmark的微基准框架，只有这一个头文件，不依赖第三方库
+ * 写法和Google Benchmark一样：
+ *     static void BM_Foo(mb::State& state) {
+ *         准备数据...
+ *         for(auto _ : state) { 被测的代码 }
+ *         state.SetItemsProcessed(state.iterations());
+ *     }
+ *     BENCHMARK(BM_Foo)->Arg(64)->Arg(4096);
+ * 迭代次数自动增长到运行时间超过min_time为止；--benchmark_format=json或--benchmark_out=文件
+ * 输出和Google Benchmark相同结构的JSON，可以直接用它的compare.py对比两次提交 */
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mb {
+
+inline uint64_t NowNs(clockid_t clock = CLOCK_MONOTONIC) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 防止编译器把没用到的结果优化掉
+template<class T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline void ClobberMemory() {
+    asm volatile("" : : : "memory");
+}
+
+// 传给每个基准函数的状态，一个线程一个
+class State {
+public:
+    State(int64_t iterations, const std::vector<int64_t>& args, int threadIndex, int threads)
+        : iterations_(iterations), left_(iterations), args_(args),
+          threadIndex_(threadIndex), threads_(threads) {}
+
+    // for(auto _ : state)里_的类型，标成unused免得编译器警告
+    struct __attribute__((unused)) Value {};
+
+    // for(auto _ : state)的迭代器，走完时停止计时
+    struct Iterator {
+        State* state;
+        int64_t left;
+        bool operator!=(const Iterator&) {
+            if(left != 0) { return true; }
+            state->StopTiming_();
+            return false;
+        }
+        void operator++() { --left; }
+        Value operator*() const { return Value(); }
+    };
+    Iterator begin() {
+        StartTiming_();
+        return Iterator{this, iterations_};
+    }
+    Iterator end() { return Iterator{this, 0}; }
+
+    // 老的写法：while(state.KeepRunning())
+    bool KeepRunning() {
+        if(left_ == iterations_) { StartTiming_(); }
+        if(left_-- > 0) { return true; }
+        StopTiming_();
+        return false;
+    }
+
+    // 暂停计时，用来排除每次迭代里的准备工作，本身有两次取时钟的开销
+    void PauseTiming() {
+        pausedAt_ = NowNs();
+        pausedCpuAt_ = NowNs(CLOCK_THREAD_CPUTIME_ID);
+    }
+    void ResumeTiming() {
+        pausedNs_ += NowNs() - pausedAt_;
+        pausedCpuNs_ += NowNs(CLOCK_THREAD_CPUTIME_ID) - pausedCpuAt_;
+    }
+
+    int64_t range(size_t i = 0) const { return i < args_.size() ? args_[i] : 0; }
+    int64_t iterations() const { return iterations_; }
+    int thread_index() const { return threadIndex_; }
+    int threads() const { return threads_; }
+
+    void SetItemsProcessed(int64_t items) { items_ = items; }
+    void SetBytesProcessed(int64_t bytes) { bytes_ = bytes; }
+    void SetLabel(const std::string& label) { label_ = label; }
+    void SkipWithError(const std::string& msg) { error_ = msg; left_ = 0; }
+
+    // 下面这些给Runner用
+    uint64_t RealNs() const { return stopNs_ - startNs_ - pausedNs_; }
+    uint64_t CpuNs() const { return stopCpuNs_ - startCpuNs_ - pausedCpuNs_; }
+    int64_t Items() const { return items_; }
+    int64_t Bytes() const { return bytes_; }
+    const std::string& Label() const { return label_; }
+    const std::string& Error() const { return error_; }
+
+private:
+    void StartTiming_() {
+        startNs_ = NowNs();
+        startCpuNs_ = NowNs(CLOCK_THREAD_CPUTIME_ID);
+    }
+    void StopTiming_() {
+        stopNs_ = NowNs();
+        stopCpuNs_ = NowNs(CLOCK_THREAD_CPUTIME_ID);
+    }
+
+    int64_t iterations_;
+    int64_t left_;
+    std::vector<int64_t> args_;
+    int threadIndex_;
+    int threads_;
+    uint64_t startNs_ = 0, stopNs_ = 0, startCpuNs_ = 0, stopCpuNs_ = 0;
+    uint64_t pausedAt_ = 0, pausedCpuAt_ = 0, pausedNs_ = 0, pausedCpuNs_ = 0;
+    int64_t items_ = 0;
+    int64_t bytes_ = 0;
+    std::string label_;
+    std::string error_;
+};
+
+// 一个注册的基准，每组参数、每个线程数各跑一次
+class Benchmark {
+public:
+    typedef std::function<void(State&)> Fn;
+
+    Benchmark(const char* name, Fn fn): name_(name), fn_(std::move(fn)) {}
+
+    Benchmark* Arg(int64_t x) { args_.push_back({x}); return this; }
+    Benchmark* Args(const std::vector<int64_t>& xs) { args_.push_back(xs); return this; }
+    // 从lo到hi，每次乘以mult，包括两头
+    Benchmark* Range(int64_t lo, int64_t hi, int64_t mult = 8) {
+        for(int64_t x = lo; x < hi; x *= mult) { args_.push_back({x}); }
+        args_.push_back({hi});
+        return this;
+    }
+    Benchmark* Threads(int n) { threads_.push_back(n); return this; }
+    Benchmark* Iterations(int64_t n) { iterations_ = n; return this; }
+    // 在所有线程开始之前/结束之后各调用一次，不计时
+    Benchmark* Setup(std::function<void(const State&)> fn) { setup_ = std::move(fn); return this; }
+    Benchmark* Teardown(std::function<void(const State&)> fn) { teardown_ = std::move(fn); return this; }
+
+    const std::string& Name() const { return name_; }
+
+private:
+    friend class Runner;
+    std::string name_;
+    Fn fn_;
+    std::vector<std::vector<int64_t>> args_;
+    std::vector<int> threads_;
+    int64_t iterations_ = 0;    // 0表示自动决定
+    std::function<void(const State&)> setup_;
+    std::function<void(const State&)> teardown_;
+};
+
+inline std::vector<std::unique_ptr<Benchmark>>& Registry() {
+    static std::vector<std::unique_ptr<Benchmark>> list;
+    return list;
+}
+
+inline Benchmark* Register(const char* name, Benchmark::Fn fn) {
+    Registry().emplace_back(new Benchmark(name, std::move(fn)));
+    return Registry().back().get();
+}
+
+class Runner {
+public:
+    struct Result {
+        std::string name;
+        int64_t iterations;
+        double realNs;      // 每次迭代
+        double cpuNs;
+        double itemsPerSec;
+        double bytesPerSec;
+        int threads;
+        std::string label;
+        std::string error;
+    };
+
+    int Main(int argc, char** argv) {
+        std::string filter = ".";
+        std::string format = "console";
+        std::string outFile;
+        for(int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if(Flag_(arg, "--benchmark_filter=", &filter) || Flag_(arg, "--benchmark_format=", &format) ||
+               Flag_(arg, "--benchmark_out=", &outFile)) {
+                continue;
+            }
+            std::string value;
+            if(Flag_(arg, "--benchmark_min_time=", &value)) {
+                minTime_ = atof(value.c_str());
+                continue;
+            }
+            if(arg == "--benchmark_list_tests") {
+                listOnly_ = true;
+                continue;
+            }
+            fprintf(stderr, "usage: %s [--benchmark_filter=regex] [--benchmark_format=console|json]\n"
+                            "          [--benchmark_out=file.json] [--benchmark_min_time=sec] [--benchmark_list_tests]\n",
+                    argv[0]);
+            return 1;
+        }
+        std::regex re;
+        try {
+            re = std::regex(filter);
+        } catch(const std::regex_error&) {
+            fprintf(stderr, "bad filter: %s\n", filter.c_str());
+            return 1;
+        }
+        bool json = format == "json";
+        if(!json) { fprintf(stdout, "%-44s %14s %14s %12s %s\n", "Benchmark", "Time", "CPU", "Iterations", "UserCounters"); }
+        for(auto& bm: Registry()) {
+            std::vector<std::vector<int64_t>> argSets = bm->args_;
+            if(argSets.empty()) { argSets.push_back({}); }
+            std::vector<int> threadSets = bm->threads_;
+            if(threadSets.empty()) { threadSets.push_back(1); }
+            for(auto& args: argSets) {
+                for(int threads: threadSets) {
+                    std::string name = bm->name_;
+                    for(int64_t a: args) { name += "/" + std::to_string(a); }
+                    if(!bm->threads_.empty()) { name += "/threads:" + std::to_string(threads); }
+                    if(!std::regex_search(name, re)) { continue; }
+                    if(listOnly_) {
+                        printf("%s\n", name.c_str());
+                        continue;
+                    }
+                    Result r = Run_(*bm, name, args, threads);
+                    if(!json) { PrintConsole_(r); }
+                    results_.push_back(r);
+                }
+            }
+        }
+        if(listOnly_) { return 0; }
+        std::string out = Json_();
+        if(json) { fputs(out.c_str(), stdout); }
+        if(!outFile.empty()) {
+            FILE* fp = fopen(outFile.c_str(), "w");
+            if(!fp) {
+                fprintf(stderr, "open %s failed\n", outFile.c_str());
+                return 1;
+            }
+            fputs(out.c_str(), fp);
+            fclose(fp);
+        }
+        return 0;
+    }
+
+private:
+    static bool Flag_(const std::string& arg, const char* prefix, std::string* value) {
+        size_t len = strlen(prefix);
+        if(arg.compare(0, len, prefix) != 0) { return false; }
+        *value = arg.substr(len);
+        return true;
+    }
+
+    // 跑一轮，所有线程同时开始，每个线程跑iterations次
+    static std::vector<std::unique_ptr<State>> RunOnce_(Benchmark& bm, const std::vector<int64_t>& args,
+                                                        int threads, int64_t iterations) {
+        std::vector<std::unique_ptr<State>> states;
+        for(int i = 0; i < threads; i++) {
+            states.emplace_back(new State(iterations, args, i, threads));
+        }
+        if(bm.setup_) { bm.setup_(*states[0]); }
+        if(threads == 1) {
+            bm.fn_(*states[0]);
+        } else {
+            std::atomic<int> ready{0};
+            std::vector<std::thread> pool;
+            for(int i = 0; i < threads; i++) {
+                pool.emplace_back([&, i] {
+                    ready++;
+                    while(ready.load() < threads) {}
+                    bm.fn_(*states[i]);
+                });
+            }
+            for(auto& t: pool) { t.join(); }
+        }
+        if(bm.teardown_) { bm.teardown_(*states[0]); }
+        return states;
+    }
+
+    Result Run_(Benchmark& bm, const std::string& name, const std::vector<int64_t>& args, int threads) {
+        int64_t iterations = bm.iterations_ > 0 ? bm.iterations_ : 1;
+        std::vector<std::unique_ptr<State>> states;
+        while(true) {
+            states = RunOnce_(bm, args, threads, iterations);
+            if(bm.iterations_ > 0 || !states[0]->Error().empty()) { break; }
+            double seconds = Slowest_(states) / 1e9;
+            if(seconds >= minTime_ || iterations >= MAX_ITERATIONS) { break; }
+            // 和Google Benchmark一样按已经用的时间估算，留一点余量，一次最多放大10倍
+            double mult = seconds > 0 ? minTime_ * 1.4 / seconds : 10;
+            if(mult > 10) { mult = 10; }
+            int64_t next = static_cast<int64_t>(iterations * mult);
+            iterations = next > iterations ? next : iterations + 1;
+            if(iterations > MAX_ITERATIONS) { iterations = MAX_ITERATIONS; }
+        }
+        Result r;
+        r.name = name;
+        r.threads = threads;
+        r.iterations = iterations;
+        r.error = states[0]->Error();
+        r.label = states[0]->Label();
+        // 多线程时和Google Benchmark一样：时间取平均，吞吐量是所有线程加起来
+        double real = 0, cpu = 0, items = 0, bytes = 0;
+        for(auto& s: states) {
+            real += s->RealNs();
+            cpu += s->CpuNs();
+            items += s->Items();
+            bytes += s->Bytes();
+        }
+        real /= threads;
+        cpu /= threads;
+        r.realNs = real / iterations;
+        r.cpuNs = cpu / iterations;
+        r.itemsPerSec = real > 0 ? items * 1e9 / real : 0;
+        r.bytesPerSec = real > 0 ? bytes * 1e9 / real : 0;
+        return r;
+    }
+
+    static double Slowest_(const std::vector<std::unique_ptr<State>>& states) {
+        double ns = 0;
+        for(auto& s: states) {
+            if(s->RealNs() > ns) { ns = s->RealNs(); }
+        }
+        return ns;
+    }
+
+    static std::string Human_(double value) {
+        char buf[32];
+        if(value >= 1e9) { snprintf(buf, sizeof(buf), "%.3gG", value / 1e9); }
+        else if(value >= 1e6) { snprintf(buf, sizeof(buf), "%.3gM", value / 1e6); }
+        else if(value >= 1e3) { snprintf(buf, sizeof(buf), "%.3gk", value / 1e3); }
+        else { snprintf(buf, sizeof(buf), "%.3g", value); }
+        return buf;
+    }
+
+    static void PrintConsole_(const Result& r) {
+        if(!r.error.empty()) {
+            printf("%-44s ERROR: %s\n", r.name.c_str(), r.error.c_str());
+            return;
+        }
+        std::string counters;
+        if(r.itemsPerSec > 0) { counters += " items/s=" + Human_(r.itemsPerSec); }
+        if(r.bytesPerSec > 0) { counters += " bytes/s=" + Human_(r.bytesPerSec); }
+        if(!r.label.empty()) { counters += " " + r.label; }
+        printf("%-44s %11.1f ns %11.1f ns %12lld%s\n", r.name.c_str(), r.realNs, r.cpuNs,
+               static_cast<long long>(r.iterations), counters.c_str());
+        fflush(stdout);
+    }
+
+    static std::string Escape_(const std::string& str) {
+        std::string out;
+        for(char ch: str) {
+            if(ch == '"' || ch == '\\') { out += '\\'; }
+            out += ch;
+        }
+        return out;
+    }
+
+    // 和Google Benchmark的JSON输出结构相同
+    std::string Json_() const {
+        char host[256] = {0};
+        gethostname(host, sizeof(host) - 1);
+        time_t now = time(nullptr);
+        struct tm t;
+        localtime_r(&now, &t);
+        char date[64];
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &t);
+        std::string out = "{\n  \"context\": {\n";
+        out += "    \"date\": \"" + std::string(date) + "\",\n";
+        out += "    \"host_name\": \"" + Escape_(host) + "\",\n";
+        out += "    \"num_cpus\": " + std::to_string(std::thread::hardware_concurrency()) + ",\n";
+#ifdef NDEBUG
+        out += "    \"library_build_type\": \"release\"\n";
+#else
+        out += "    \"library_build_type\": \"debug\"\n";
+#endif
+        out += "  },\n  \"benchmarks\": [\n";
+        char line[512];
+        for(size_t i = 0; i < results_.size(); i++) {
+            const Result& r = results_[i];
+            snprintf(line, sizeof(line),
+                     "    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"iteration\",\n"
+                     "      \"threads\": %d,\n      \"iterations\": %lld,\n      \"real_time\": %.4f,\n"
+                     "      \"cpu_time\": %.4f,\n      \"time_unit\": \"ns\"",
+                     Escape_(r.name).c_str(), Escape_(r.name).c_str(), r.threads,
+                     static_cast<long long>(r.iterations), r.realNs, r.cpuNs);
+            out += line;
+            if(r.itemsPerSec > 0) {
+                snprintf(line, sizeof(line), ",\n      \"items_per_second\": %.4f", r.itemsPerSec);
+                out += line;
+            }
+            if(r.bytesPerSec > 0) {
+                snprintf(line, sizeof(line), ",\n      \"bytes_per_second\": %.4f", r.bytesPerSec);
+                out += line;
+            }
+            if(!r.label.empty()) { out += ",\n      \"label\": \"" + Escape_(r.label) + "\""; }
+            if(!r.error.empty()) {
+                out += ",\n      \"error_occurred\": true,\n      \"error_message\": \"" + Escape_(r.error) + "\"";
+            }
+            out += i + 1 < results_.size() ? "\n    },\n" : "\n    }\n";
+        }
+        out += "  ]\n}\n";
+        return out;
+    }
+
+    static const int64_t MAX_ITERATIONS = 1000000000;
+
+    double minTime_ = 0.5;  // 秒
+    bool listOnly_ = false;
+    std::vector<Result> results_;
+};
+
+} // namespace mb
+
+#define MB_CONCAT_(a, b) a##b
+#define MB_CONCAT(a, b) MB_CONCAT_(a, b)
+#define BENCHMARK(fn) \
+    static mb::Benchmark* MB_CONCAT(mb_registered_, __LINE__) = mb::Register(#fn, fn)
+#define BENCHMARK_MAIN() \
+    int main(int argc, char** argv) { return mb::Runner().Main(argc, argv); }
+
+#endif //MICROBENCH_H
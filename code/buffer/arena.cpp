@@ -0,0 +1,60 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */ 
+#include "arena.h"
+#include <string.h>
+
+Arena::Arena(size_t blockSize): blockSize_(blockSize), cur_(0),
+            ptr_(nullptr), end_(nullptr), used_(0), capacity_(0) {}
+
+std::string_view Arena::Copy(std::string_view str) {
+    if(str.empty()) { return std::string_view(); }
+    char* p = Alloc(str.size());
+    memcpy(p, str.data(), str.size());
+    return std::string_view(p, str.size());
+}
+
+std::string_view Arena::Concat(std::string_view a, std::string_view b) {
+    char* p = Alloc(a.size() + b.size());
+    memcpy(p, a.data(), a.size());
+    memcpy(p + a.size(), b.data(), b.size());
+    return std::string_view(p, a.size() + b.size());
+}
+
+// 当前块不够了，先找后面已经申请过的块，都放不下才申请新块
+char* Arena::AllocSlow_(size_t len) {
+    size_t next = ptr_ ? cur_ + 1 : 0;
+    while(next < blocks_.size() && blocks_[next].size < len) { next++; }
+    if(next >= blocks_.size()) {
+        // 大的请求体单独占一块
+        size_t size = len > blockSize_ ? len : blockSize_;
+        blocks_.push_back({ std::unique_ptr<char[]>(new char[size]), size });
+        capacity_ += size;
+        next = blocks_.size() - 1;
+    }
+    // 跳过的块这次请求就不用了，Reset后再复用
+    cur_ = next;
+    ptr_ = blocks_[cur_].data.get() + len;
+    end_ = blocks_[cur_].data.get() + blocks_[cur_].size;
+    used_ += len;
+    return blocks_[cur_].data.get();
+}
+
+void Arena::Reset() {
+    used_ = 0;
+    if(capacity_ > MAX_RETAIN) {
+        // 一个大请求用了很多内存，只留一个普通大小的块，避免连接一直占着
+        if(blocks_[0].size > blockSize_) { blocks_.clear(); }
+        else { blocks_.resize(1); }
+        capacity_ = blocks_.empty() ? 0 : blocks_[0].size;
+    }
+    cur_ = 0;
+    if(blocks_.empty()) {
+        ptr_ = end_ = nullptr;
+        return;
+    }
+    ptr_ = blocks_[0].data.get();
+    end_ = ptr_ + blocks_[0].size;
+}
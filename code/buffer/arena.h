@@ -0,0 +1,64 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */ 
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <stddef.h>
+
+// 每个连接一个的线性分配器，解析请求时的请求行、请求头、请求体都拷贝到这里，
+// 分配只是移动指针，一个请求处理完以后Reset就全部释放，内存块留着给下一个请求用，
+// 长连接上稳定以后解析请求不再调用malloc
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 4096);
+    ~Arena() = default;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    char* Alloc(size_t len);    // 分配len个字节，不做对齐，只用来放字符
+    std::string_view Copy(std::string_view str);    // 拷贝一份，返回指向arena的视图
+    std::string_view Concat(std::string_view a, std::string_view b);  // 拼接两段
+
+    // 释放本次请求分配的所有内存，O(1)，只有一个请求用了特别多内存时才把多出来的块还给系统
+    void Reset();
+
+    size_t Used() const { return used_; }   // 本次请求分配的字节数
+    size_t Capacity() const { return capacity_; }  // 持有的总字节数
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    char* AllocSlow_(size_t len);
+
+    static const size_t MAX_RETAIN = 64 * 1024;  // Reset时最多保留的内存
+
+    size_t blockSize_;          // 普通块的大小
+    std::vector<Block> blocks_; // 已经申请的块，Reset以后从头复用
+    size_t cur_;                // 当前在用的块的下标
+    char* ptr_;                 // 当前块里下一个可用的位置
+    char* end_;                 // 当前块的末尾
+    size_t used_;
+    size_t capacity_;
+};
+
+// 热路径内联，当前块放得下时只移动指针
+inline char* Arena::Alloc(size_t len) {
+    if(static_cast<size_t>(end_ - ptr_) >= len) {
+        char* p = ptr_;
+        ptr_ += len;
+        used_ += len;
+        return p;
+    }
+    return AllocSlow_(len);
+}
+
+#endif //ARENA_H
@@ -5,7 +5,15 @@
  */ 
 #include "buffer.h"
 
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+std::atomic<size_t> Buffer::totalBytes_{0};
+
+Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0), maxSize_(0) {
+    totalBytes_.fetch_add(buffer_.size(), std::memory_order_relaxed);
+}
+
+Buffer::~Buffer() {
+    totalBytes_.fetch_sub(buffer_.size(), std::memory_order_relaxed);
+}
 
 // 还可以读的数据
 size_t Buffer::ReadableBytes() const {
@@ -28,6 +36,11 @@ const char* Buffer::Peek() const {
 void Buffer::Retrieve(size_t len) {
     assert(len <= ReadableBytes());
     readPos_ += len;
+    // 读完了就回到开头，后面写的时候不用再搬数据
+    if(readPos_ == writePos_) {
+        readPos_ = 0;
+        writePos_ = 0;
+    }
 }
 // 将读指针往后移动到end位置
 void Buffer::RetrieveUntil(const char* end) {
@@ -36,7 +49,6 @@ void Buffer::RetrieveUntil(const char* end) {
 }
 // 重置缓冲区
 void Buffer::RetrieveAll() {
-    bzero(&buffer_[0], buffer_.size());
     readPos_ = 0;
     writePos_ = 0;
 }
@@ -91,29 +103,31 @@ void Buffer::EnsureWriteable(size_t len) {
     }
     assert(WritableBytes() >= len);
 }
-// 真正的读取数据,把数据放到buffer_缓冲区当中
-ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
-    char buff[65535];  // 临时的数组，保证能够把所有的数据都读出来
-    struct iovec iov[2];
-    const size_t writable = WritableBytes();
-    /* 分散读， 保证数据全部读完 */
-    iov[0].iov_base = BeginPtr_() + writePos_;
-    iov[0].iov_len = writable;
-    iov[1].iov_base = buff;
-    iov[1].iov_len = sizeof(buff);
-
-    // readv总是会先充满一个缓冲区再往下一个写
-    const ssize_t len = readv(fd, iov, 2);
+// 真正的读取数据，直接读进buffer_，不再经过栈上64KB的临时数组再拷贝一次
+// hint是这个连接平时一次读到的数据量，可写空间比它小时才去问内核实际有多少数据，按实际的量扩容
+ssize_t Buffer::ReadFd(int fd, int* saveErrno, size_t hint) {
+    if(WritableBytes() < hint || WritableBytes() == 0) {
+        int avail = 0;
+        if(ioctl(fd, FIONREAD, &avail) < 0) { avail = 0; }
+        size_t need = avail > 0 ? static_cast<size_t>(avail) : MIN_READ;
+        if(need > MAX_READ) { need = MAX_READ; }
+        // 不超过上限，超过上限的部分留在内核里
+        if(maxSize_ > 0 && ReadableBytes() + need > maxSize_) {
+            need = maxSize_ > ReadableBytes() ? maxSize_ - ReadableBytes() : 0;
+        }
+        if(WritableBytes() < need) { EnsureWriteable(need); }
+        if(WritableBytes() == 0) {
+            // 缓冲区已经到上限了还没有处理掉，一般是请求太大
+            *saveErrno = ENOBUFS;
+            return -1;
+        }
+    }
+    const ssize_t len = read(fd, BeginWrite(), WritableBytes());
     if(len < 0) {
         *saveErrno = errno;
     }
-    else if(static_cast<size_t>(len) <= writable) {
-        writePos_ += len;
-    }
     else {
-        // 缓冲区已经读满了，就要把临时buff里面的数据拷贝进buffer中
-        writePos_ = buffer_.size();
-        Append(buff, len - writable);
+        writePos_ += len;
     }
     return len;
 }
@@ -139,17 +153,38 @@ const char* Buffer::BeginPtr_() const {
 
 // 新增长空间
 void Buffer::MakeSpace_(size_t len) {
-    // 如果加上前面可拓展的空间还是不够，就要扩展缓冲区了
-    if(WritableBytes() + PrependableBytes() < len) {
-        buffer_.resize(writePos_ + len + 1);
-    } 
-    else {
-        size_t readable = ReadableBytes();
+    size_t readable = ReadableBytes();
+    // 前面空出来的地方够用，并且要搬的数据不多时才整理，否则直接扩容
+    if(WritableBytes() + PrependableBytes() >= len && readable <= COMPACT_MAX) {
         // 数据分为三段 0- readPos_ - writePos_ , readPos_ - writePos_这一段是还没有读的，而0 - readPos_这一段是已经读完了，可以给覆盖了
-        // 这样就可以把临时的buff数据放到后面空余的位置了，因为此时位置必然是够的
-        std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, BeginPtr_());
+        // 只搬还没有读的这一段
+        memmove(BeginPtr_(), BeginPtr_() + readPos_, readable);
         readPos_ = 0;
-        writePos_ = readPos_ + readable;
-        assert(readable == ReadableBytes());
+        writePos_ = readable;
+        return;
     }
-}
\ No newline at end of file
+    // 按倍数增长，避免一点一点地resize
+    size_t size = buffer_.size() * 2;
+    if(size < readable + len) { size = readable + len; }
+    if(maxSize_ > 0 && size > maxSize_ && readable + len <= maxSize_) { size = maxSize_; }
+    Realloc_(size);
+}
+
+// 换一块size大小的内存，只拷贝还没有读的数据，统计总字节数
+void Buffer::Realloc_(size_t size) {
+    size_t readable = ReadableBytes();
+    assert(size >= readable);
+    std::vector<char> newBuffer(size);
+    memcpy(newBuffer.data(), Peek(), readable);
+    totalBytes_.fetch_add(size, std::memory_order_relaxed);
+    totalBytes_.fetch_sub(buffer_.size(), std::memory_order_relaxed);
+    buffer_.swap(newBuffer);
+    readPos_ = 0;
+    writePos_ = readable;
+}
+
+// 把内存还回去，留下keep和没读完的数据中大的那个
+void Buffer::Shrink(size_t keep) {
+    size_t size = ReadableBytes() > keep ? ReadableBytes() : keep;
+    if(buffer_.size() > size) { Realloc_(size); }
+}
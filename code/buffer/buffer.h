@@ -10,13 +10,15 @@
 #include <iostream>
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
+#include <sys/ioctl.h> //FIONREAD
 #include <vector> //readv
 #include <atomic>
+#include <errno.h>
 #include <assert.h>
 class Buffer {
 public:
     Buffer(int initBuffSize = 1024);  // 初始化一开始可以装字符的数量，默认1024
-    ~Buffer() = default;
+    ~Buffer();
 
     size_t WritableBytes() const;   // 还可以写的字节数
           
@@ -42,17 +44,32 @@ public:
     void Append(const void* data, size_t len); 
     void Append(const Buffer& buff);  // 未用到,将buff还没有读完的数据拷贝给当前的buffer_
 
-    ssize_t ReadFd(int fd, int* Errno);  // 真正的读取数据,把数据放到buffer_缓冲区当中
+    ssize_t ReadFd(int fd, int* Errno, size_t hint = 0);  // 真正的读取数据,把数据放到buffer_缓冲区当中，hint是预计要读的字节数
     ssize_t WriteFd(int fd, int* Errno); // 未用到
 
+    size_t Capacity() const { return buffer_.size(); }  // 当前占用的内存
+    // 缓冲区的上限，ReadFd不会扩到超过它，0表示不限制
+    void SetMaxSize(size_t maxSize) { maxSize_ = maxSize; }
+    // 占用超过keep时把多的内存还回去，在一个请求处理完以后调用
+    void Shrink(size_t keep);
+    // 所有缓冲区占用的内存
+    static size_t TotalBytes() { return totalBytes_.load(std::memory_order_relaxed); }
+
 private:
     char* BeginPtr_(); //返回buffer_首字符的地址
     const char* BeginPtr_() const; //返回buffer_首字符的地址，const版本
     void MakeSpace_(size_t len);  // 自动增长新空间,先看覆盖前面已经读了的够不够，不够再扩展空间
+    void Realloc_(size_t size);   // 换成size大小的内存
+
+    static const size_t MIN_READ = 4096;        // 缓冲区满了又不知道有多少数据时至少扩这么多
+    static const size_t MAX_READ = 64 * 1024;   // 一次最多为读扩容这么多
+    static const size_t COMPACT_MAX = 4096;     // 没读的数据比这个多时宁可扩容也不搬
+    static std::atomic<size_t> totalBytes_;     // 所有缓冲区占用的内存
 
     std::vector<char> buffer_;   // 具体装数据的vector
     std::atomic<std::size_t> readPos_;  // 读的位置，std::atomic保证是原子操作的，相当于系统在操作该变量时给他上了一个锁
     std::atomic<std::size_t> writePos_; // 写的位置
+    size_t maxSize_;    // 上限，0表示不限制
 };
 
 #endif //BUFFER_H
\ No newline at end of file
@@ -0,0 +1,133 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+#include "writequeue.h"
+
+#include <sys/uio.h>        // writev
+#include <sys/sendfile.h>   // sendfile
+#include <sys/socket.h>     // sendmsg
+#include <algorithm>
+
+WriteQueue::FileRef::~FileRef() {
+    if(fd >= 0) { close(fd); }
+}
+
+WriteQueue::WriteQueue(): head_(0), bytes_(0), msgMore_(true) {}
+
+void WriteQueue::AppendBuffer(Buffer* buff, size_t len) {
+    assert(buff);
+    if(len == 0) { return; }
+    // 和上一段是同一个缓冲区里接着的数据，直接合并
+    if(head_ < segs_.size() && segs_.back().type == BUFFER && segs_.back().buff == buff) {
+        segs_.back().len += len;
+    } else {
+        segs_.push_back({BUFFER, len, buff, nullptr, -1, 0, nullptr});
+    }
+    bytes_ += len;
+}
+
+void WriteQueue::AppendMemory(const char* data, size_t len, std::shared_ptr<const void> holder) {
+    if(len == 0) { return; }
+    segs_.push_back({MEMORY, len, nullptr, data, -1, 0, std::move(holder)});
+    bytes_ += len;
+}
+
+void WriteQueue::AppendFile(int fd, off_t offset, size_t len, std::shared_ptr<const void> holder) {
+    assert(fd >= 0);
+    if(len == 0) { return; }
+    segs_.push_back({FILE, len, nullptr, nullptr, fd, offset, std::move(holder)});
+    bytes_ += len;
+}
+
+bool WriteQueue::Flush(int fd, int* saveErrno, size_t* written) {
+    *written = 0;
+    while(head_ < segs_.size()) {
+        ssize_t len = segs_[head_].type == FILE ? WriteFile_(fd) : WriteMemory_(fd);
+        if(len < 0) {
+            if(errno == EINTR) { continue; }
+            *saveErrno = errno;
+            return false;
+        }
+        if(len == 0) {
+            // 只有sendfile会返回0，文件在发送过程中变短了，长度对不上只能断开
+            *saveErrno = EIO;
+            return false;
+        }
+        *written += len;
+        Consume_(len);
+    }
+    Clear();
+    return true;
+}
+
+ssize_t WriteQueue::WriteMemory_(int fd) {
+    struct iovec iov[MAX_IOV];
+    int cnt = 0;
+    // 同一个缓冲区的段在缓冲区里是连着的，第一段从Peek()开始
+    Buffer* buff = nullptr;
+    size_t buffOffset = 0;
+    bool more = false;
+    for(size_t i = head_; i < segs_.size() && cnt < MAX_IOV; i++) {
+        const Segment& seg = segs_[i];
+        if(seg.type == FILE) {
+            more = msgMore_;
+            break;
+        }
+        if(seg.type == BUFFER) {
+            if(buff && seg.buff != buff) { break; }
+            buff = seg.buff;
+            iov[cnt].iov_base = const_cast<char*>(buff->Peek()) + buffOffset;
+            buffOffset += seg.len;
+        } else {
+            iov[cnt].iov_base = const_cast<char*>(seg.data);
+        }
+        iov[cnt].iov_len = seg.len;
+        cnt++;
+    }
+    if(!more) {
+        return writev(fd, iov, cnt);
+    }
+    // 后面紧跟着文件段，MSG_MORE让内核先攒着，响应头和文件开头能合成一个包发出去
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cnt;
+    return sendmsg(fd, &msg, MSG_MORE | MSG_NOSIGNAL);
+}
+
+ssize_t WriteQueue::WriteFile_(int fd) {
+    Segment& seg = segs_[head_];
+    off_t offset = seg.offset;
+    return sendfile(fd, seg.fd, &offset, std::min(seg.len, MAX_SENDFILE));
+}
+
+void WriteQueue::Consume_(size_t len) {
+    assert(len <= bytes_);
+    bytes_ -= len;
+    while(len > 0) {
+        Segment& seg = segs_[head_];
+        size_t n = std::min(len, seg.len);
+        if(seg.type == BUFFER) {
+            seg.buff->Retrieve(n);
+        } else if(seg.type == MEMORY) {
+            seg.data += n;
+        } else {
+            seg.offset += n;
+        }
+        seg.len -= n;
+        len -= n;
+        if(seg.len == 0) {
+            // 写完的段马上释放它持有的文件或内存
+            seg.holder.reset();
+            head_++;
+        }
+    }
+}
+
+void WriteQueue::Clear() {
+    // clear不释放vector的容量，长连接上稳定以后入队不再分配内存
+    segs_.clear();
+    head_ = 0;
+    bytes_ = 0;
+}
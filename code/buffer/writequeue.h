@@ -0,0 +1,77 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+#ifndef WRITE_QUEUE_H
+#define WRITE_QUEUE_H
+
+#include <vector>
+#include <memory>
+#include <sys/types.h>
+#include <limits.h>      // IOV_MAX
+#include "buffer.h"
+
+// 连接的发送队列，一个响应由若干段组成，按顺序发出去，不需要先拷贝到一起：
+//   BUFFER  缓冲区开头的len个字节，发出去以后从缓冲区里Retrieve掉
+//   MEMORY  一块别人持有的内存，比如文件缓存，holder保证发完之前不被释放
+//   FILE    文件的一段，用sendfile发，不经过用户态
+// 连续的内存段合成一次writev，最多IOV_MAX段，写了一部分时记在段自己身上，下次接着写
+class WriteQueue {
+public:
+    WriteQueue();
+    ~WriteQueue() = default;
+
+    WriteQueue(const WriteQueue&) = delete;
+    WriteQueue& operator=(const WriteQueue&) = delete;
+
+    // buff中还没有入队的数据里接下来的len个字节，同一个buff的段必须按写进去的顺序入队
+    void AppendBuffer(Buffer* buff, size_t len);
+    void AppendMemory(const char* data, size_t len, std::shared_ptr<const void> holder = nullptr);
+    void AppendFile(int fd, off_t offset, size_t len, std::shared_ptr<const void> holder);
+
+    // 一直写到队列空或者写不进去，written是这次写出去的字节数，
+    // 队列写空返回true，否则返回false，saveErrno里是原因(EAGAIN表示socket缓冲区满了)
+    bool Flush(int fd, int* saveErrno, size_t* written);
+
+    // 文件段前面的内存段是否带MSG_MORE发送，外面用TCP_CORK时不需要
+    void SetMsgMore(bool on) { msgMore_ = on; }
+
+    size_t Bytes() const { return bytes_; }   // 还没写出去的字节数
+    bool Empty() const { return bytes_ == 0; }
+    void Clear();   // 丢掉所有的段，释放它们持有的内存和文件
+
+    // 文件段用的holder，最后一个引用释放时关闭文件
+    struct FileRef {
+        explicit FileRef(int fd): fd(fd) {}
+        ~FileRef();
+        int fd;
+    };
+
+private:
+    enum TYPE { BUFFER, MEMORY, FILE };
+
+    struct Segment {
+        TYPE type;
+        size_t len;             // 还剩多少没写
+        Buffer* buff;           // BUFFER
+        const char* data;       // MEMORY
+        int fd;                 // FILE
+        off_t offset;           // FILE
+        std::shared_ptr<const void> holder;
+    };
+
+    ssize_t WriteMemory_(int fd);   // 从队头开始把连续的内存段合成一次writev
+    ssize_t WriteFile_(int fd);     // 队头是文件段，sendfile
+    void Consume_(size_t len);      // 从队头去掉已经写出去的len个字节
+
+    std::vector<Segment> segs_;     // [head_, size)是还没写完的段，写空了才clear，容量留着复用
+    size_t head_;
+    size_t bytes_;
+    bool msgMore_;
+
+    static const int MAX_IOV = IOV_MAX;
+    static const size_t MAX_SENDFILE = 1 << 30;   // sendfile一次最多发这么多
+};
+
+#endif //WRITE_QUEUE_H
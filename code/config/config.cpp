@@ -0,0 +1,393 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-28
+ * @copyleft Apache 2.0
+ */
+#include "config.h"
+
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "../log/log.h"
+#include "../pool/affinity.h"
+#include "../server/listenaddr.h"
+
+using namespace std;
+
+namespace {
+
+enum OPT_TYPE { INT, BOOL, STRING };
+enum RELOAD { RESTART, LIVE };  // 重新加载配置时能不能直接生效
+
+// 参数表，配置文件和命令行都通过它来设置，帮助信息也从这里生成
+struct Option {
+    const char* name;
+    RELOAD reload;
+    OPT_TYPE type;
+    int Config::* intVal;
+    bool Config::* boolVal;
+    string Config::* strVal;
+    long min;
+    long max;
+    const char* help;
+};
+
+#define OPT_INT(name, reload, member, min, max, help) \
+    { name, reload, INT, &Config::member, nullptr, nullptr, min, max, help }
+#define OPT_BOOL(name, reload, member, help) \
+    { name, reload, BOOL, nullptr, &Config::member, nullptr, 0, 1, help }
+#define OPT_STR(name, reload, member, help) \
+    { name, reload, STRING, nullptr, nullptr, &Config::member, 0, 0, help }
+
+const Option OPTIONS[] = {
+    OPT_INT("port", RESTART, port, 1, 65535, "listen port"),
+    OPT_STR("listen", RESTART, listen, "bind addresses, e.g. 0.0.0.0,[::]:8080; empty binds 0.0.0.0:port"),
+    OPT_BOOL("ipv6_only", RESTART, ipv6Only, "IPV6_V6ONLY on IPv6 listeners, off makes [::] dual-stack"),
+    OPT_INT("trig_mode", RESTART, trigMode, 0, 3, "0:LT+LT 1:LT+ET 2:ET+LT 3:ET+ET (listen+conn)"),
+    OPT_INT("timeout_ms", LIVE, timeoutMs, 0, 86400000, "idle connection timeout, 0 disables"),
+    OPT_BOOL("linger", RESTART, optLinger, "SO_LINGER graceful close"),
+    OPT_INT("backlog", RESTART, backlog, 1, 65535, "listen backlog"),
+    OPT_BOOL("tcp_nodelay", RESTART, tcpNoDelay, "disable Nagle on client sockets"),
+    OPT_STR("coalesce", RESTART, coalesce, "header+file coalescing, more: MSG_MORE cork: TCP_CORK off: none"),
+    OPT_INT("defer_accept", RESTART, deferAcceptSec, 0, 3600, "TCP_DEFER_ACCEPT seconds, 0 disables"),
+    OPT_INT("fastopen", RESTART, fastOpen, 0, 65535, "TCP_FASTOPEN queue length, 0 disables"),
+    OPT_INT("sndbuf", RESTART, sndBuf, 0, 64 * 1024 * 1024, "SO_SNDBUF of client sockets, 0 keeps kernel autotuning"),
+    OPT_INT("rcvbuf", RESTART, rcvBuf, 0, 64 * 1024 * 1024, "SO_RCVBUF of client sockets, 0 keeps kernel autotuning"),
+
+    OPT_STR("sql_host", RESTART, sqlHost, "MySQL host"),
+    OPT_INT("sql_port", RESTART, sqlPort, 1, 65535, "MySQL port"),
+    OPT_STR("sql_user", RESTART, sqlUser, "MySQL user"),
+    OPT_STR("sql_password", RESTART, sqlPwd, "MySQL password"),
+    OPT_STR("sql_db", RESTART, dbName, "MySQL database"),
+    OPT_INT("sql_pool", RESTART, connPoolNum, 1, 1024, "MySQL connection pool size"),
+    OPT_BOOL("sql_stub", RESTART, sqlStub, "verify users against an in-memory table (bench/bench) instead of MySQL"),
+
+    OPT_INT("threads", RESTART, threadNum, 1, 1024, "worker thread count"),
+    OPT_INT("buffer_size", RESTART, bufferSize, 64, 16 * 1024 * 1024, "initial per-connection buffer size"),
+    OPT_INT("buffer_max", RESTART, bufferMax, 64 * 1024, 1 << 30, "max per-connection read buffer, larger requests are dropped"),
+
+    OPT_STR("loop_cpus", RESTART, loopCpus, "pin the event loop thread to these cpus, e.g. 0 or 0-1"),
+    OPT_STR("worker_cpus", RESTART, workerCpus, "pin worker threads round-robin to these cpus"),
+    OPT_STR("log_cpus", RESTART, logCpus, "pin the async log writer to these cpus"),
+    OPT_BOOL("numa_local", RESTART, numaLocal, "pinned threads prefer memory from their NUMA node"),
+
+    OPT_BOOL("log", RESTART, openLog, "enable logging"),
+    OPT_INT("log_level", LIVE, logLevel, 0, 3, "0:debug 1:info 2:warn 3:error"),
+    OPT_INT("log_queue", RESTART, logQueSize, 0, 1 << 20, "async log queue size, 0 writes synchronously"),
+    OPT_STR("log_dir", RESTART, logDir, "log directory"),
+    OPT_INT("log_max_mb", RESTART, logMaxMb, 0, 1 << 20, "start a new log file at this size, 0 rotates daily only"),
+    OPT_BOOL("log_compress", RESTART, logCompress, "gzip rotated log files in the background"),
+    OPT_STR("log_overflow", RESTART, logOverflow, "when the async queue is full: drop_newest, drop_oldest, sample or block"),
+
+    OPT_STR("access_log", RESTART, accessLog, "access log file, empty disables"),
+    OPT_STR("access_log_format", RESTART, accessLogFormat, "common or json"),
+    OPT_INT("access_log_sample", RESTART, accessLogSample, 1, 1000000, "log one in N successful requests, errors always"),
+    OPT_INT("access_log_max_mb", RESTART, accessLogMaxMb, 0, 1 << 20, "rotate the access log at this size, 0 disables"),
+    OPT_INT("access_log_rotate_sec", RESTART, accessLogRotateSec, 0, 86400 * 30, "rotate the access log this often, 0 disables"),
+    OPT_INT("access_log_flush_ms", RESTART, accessLogFlushMs, 1, 60000, "max time a record waits in memory"),
+
+    OPT_STR("admin_access", RESTART, adminAccess, "who may read /__stats and /__trace: off, local (loopback only) or all"),
+
+    OPT_BOOL("trace", LIVE, trace, "record per-stage request timings, dump them at /__trace"),
+
+    OPT_STR("resources", RESTART, srcDir, "static resource directory, default ./resources/"),
+    OPT_INT("file_cache", RESTART, fileCache, 0, 1 << 20, "open files and stat results to cache, 0 disables"),
+    OPT_BOOL("file_cache_inotify", RESTART, fileCacheInotify, "invalidate cached files on inotify events"),
+    OPT_INT("file_cache_revalidate_ms", LIVE, fileCacheRevalidateMs, 0, 3600000, "reopen cached files this often, 0 relies on inotify"),
+    OPT_BOOL("preload", RESTART, preload, "pack static files and their headers into a memory image at startup"),
+    OPT_INT("preload_max_mb", RESTART, preloadMaxMb, 1, 4096, "maximum size of the preloaded image"),
+    OPT_INT("preload_max_file_kb", RESTART, preloadMaxFileKb, 1, 1 << 20, "files larger than this are not preloaded"),
+
+    OPT_INT("max_queue", LIVE, maxQueue, 0, 1 << 30, "shed when the thread pool queue is this deep, 0 disables"),
+    OPT_INT("max_inflight", LIVE, maxInflight, 0, 1 << 30, "shed at this many in-flight tasks, 0 disables"),
+    OPT_INT("max_loop_lag_ms", LIVE, maxLoopLagMs, 0, 60000, "shed when the event loop lags this much, 0 disables"),
+    OPT_INT("max_conn_per_ip", RESTART, maxConnPerIp, 0, 1 << 30, "connections per client ip, 0 disables"),
+    OPT_STR("overload_mode", LIVE, overloadMode, "shed: reply 503, pause: stop accepting"),
+
+    OPT_INT("drain_timeout_ms", LIVE, drainTimeoutMs, 0, 3600000, "max time to drain connections on exit"),
+    OPT_STR("handoff_path", RESTART, handoffPath, "unix socket for listen fd handoff, empty disables"),
+};
+
+#undef OPT_INT
+#undef OPT_BOOL
+#undef OPT_STR
+
+// 命令行里用-和_都可以
+string NormalizeKey(string key) {
+    for(auto& ch: key) {
+        if(ch == '-') { ch = '_'; }
+    }
+    return key;
+}
+
+string Trim(const string& str) {
+    size_t begin = str.find_first_not_of(" \t\r\n");
+    if(begin == string::npos) { return ""; }
+    size_t end = str.find_last_not_of(" \t\r\n");
+    return str.substr(begin, end - begin + 1);
+}
+
+bool ParseBool(const string& value, bool* out) {
+    if(value == "1" || value == "true" || value == "on" || value == "yes") {
+        *out = true;
+        return true;
+    }
+    if(value == "0" || value == "false" || value == "off" || value == "no") {
+        *out = false;
+        return true;
+    }
+    return false;
+}
+
+bool CheckCpuList(const char* name, const string& spec, string* err) {
+    vector<int> cpus;
+    if(!CpuAffinity::ParseCpuList(spec, &cpus)) {
+        *err = string(name) + ": bad cpu list: " + spec;
+        return false;
+    }
+    for(int cpu: cpus) {
+        if(!CpuAffinity::Allowed(cpu)) {
+            *err = string(name) + ": cpu " + to_string(cpu) + " is not available";
+            return false;
+        }
+    }
+    return true;
+}
+
+const Option* FindOption(const string& name) {
+    for(auto& opt: OPTIONS) {
+        if(name == opt.name) { return &opt; }
+    }
+    return nullptr;
+}
+
+string OptionValue(const Config& config, const Option& opt) {
+    switch(opt.type) {
+    case INT: return to_string(config.*opt.intVal);
+    case BOOL: return config.*opt.boolVal ? "true" : "false";
+    default: return config.*opt.strVal;
+    }
+}
+
+} // namespace
+
+bool Config::Set(const string& key, const string& value, string* err) {
+    string name = NormalizeKey(key);
+    const Option* opt = FindOption(name);
+    if(!opt) {
+        *err = "unknown option: " + key;
+        return false;
+    }
+    if(opt->type == INT) {
+        char* end = nullptr;
+        errno = 0;
+        long val = strtol(value.c_str(), &end, 10);
+        if(value.empty() || *end != '\0' || errno == ERANGE) {
+            *err = name + ": not an integer: " + value;
+            return false;
+        }
+        if(val < opt->min || val > opt->max) {
+            *err = name + ": " + value + " out of range [" + to_string(opt->min)
+                    + ", " + to_string(opt->max) + "]";
+            return false;
+        }
+        this->*opt->intVal = static_cast<int>(val);
+    }
+    else if(opt->type == BOOL) {
+        if(!ParseBool(value, &(this->*opt->boolVal))) {
+            *err = name + ": not a boolean: " + value;
+            return false;
+        }
+    }
+    else {
+        this->*opt->strVal = value;
+    }
+    return true;
+}
+
+bool Config::LoadFile_(const string& path, string* err) {
+    ifstream in(path);
+    if(!in) {
+        *err = "cannot open config file: " + path;
+        return false;
+    }
+    string line;
+    int lineNo = 0;
+    while(getline(in, line)) {
+        lineNo++;
+        size_t comment = line.find('#');
+        if(comment != string::npos) { line.resize(comment); }
+        line = Trim(line);
+        if(line.empty()) { continue; }
+        size_t eq = line.find('=');
+        if(eq == string::npos) {
+            *err = path + ":" + to_string(lineNo) + ": expect key = value";
+            return false;
+        }
+        if(!Set(Trim(line.substr(0, eq)), Trim(line.substr(eq + 1)), err)) {
+            *err = path + ":" + to_string(lineNo) + ": " + *err;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Config::Load(int argc, char* argv[], string* err) {
+    bool takeoverFlag = false;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "-h" || arg == "--help") {
+            help = true;
+            return true;
+        }
+        if(arg == "--takeover") {
+            takeoverFlag = true;
+            continue;
+        }
+        if(arg.compare(0, 2, "--") != 0) {
+            *err = "unexpected argument: " + arg;
+            return false;
+        }
+        string key, value;
+        size_t eq = arg.find('=');
+        const Option* opt = FindOption(NormalizeKey(arg.substr(2)));
+        bool flag;
+        if(eq != string::npos) {
+            key = arg.substr(2, eq - 2);
+            value = arg.substr(eq + 1);
+        } else if(opt && opt->type == BOOL) {
+            // 只写--key的布尔参数表示打开，后面跟着true/false之类的值时也认
+            key = arg.substr(2);
+            value = "true";
+            if(i + 1 < argc && ParseBool(argv[i + 1], &flag)) { value = argv[++i]; }
+        } else if(i + 1 < argc) {
+            key = arg.substr(2);
+            value = argv[++i];
+        } else {
+            *err = "missing value for " + arg;
+            return false;
+        }
+        if(key == "config") {
+            configPath = value;
+        } else {
+            overrides_.emplace_back(key, value);
+        }
+    }
+    if(!Reload(err)) { return false; }
+    takeover = takeoverFlag;
+    return true;
+}
+
+bool Config::Reload(string* err) {
+    Config next;
+    next.configPath = configPath;
+    next.overrides_ = overrides_;
+    if(!next.configPath.empty() && !next.LoadFile_(next.configPath, err)) {
+        return false;
+    }
+    for(auto& item: next.overrides_) {
+        if(!next.Set(item.first, item.second, err)) { return false; }
+    }
+    if(!next.Validate(err)) {
+        return false;
+    }
+    *this = next;
+    return true;
+}
+
+bool Config::Validate(string* err) const {
+    vector<ListenAddr> addrs;
+    if(!ListenAddr::ParseList(listen, port, &addrs, err)) {
+        return false;
+    }
+    if(coalesce != "more" && coalesce != "cork" && coalesce != "off") {
+        *err = "coalesce must be more, cork or off: " + coalesce;
+        return false;
+    }
+    if(adminAccess != "off" && adminAccess != "local" && adminAccess != "all") {
+        *err = "admin_access must be off, local or all: " + adminAccess;
+        return false;
+    }
+    if(overloadMode != "shed" && overloadMode != "pause") {
+        *err = "overload_mode must be shed or pause: " + overloadMode;
+        return false;
+    }
+    if(handoffPath.size() >= sizeof(sockaddr_un::sun_path)) {
+        *err = "handoff_path too long: " + handoffPath;
+        return false;
+    }
+    if(!srcDir.empty()) {
+        struct stat st;
+        if(stat(srcDir.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) {
+            *err = "resources is not a directory: " + srcDir;
+            return false;
+        }
+    }
+    if(fileCache > 0 && !fileCacheInotify && fileCacheRevalidateMs == 0) {
+        *err = "file_cache_revalidate_ms must be > 0 when file_cache_inotify is off";
+        return false;
+    }
+    if(!CheckCpuList("loop_cpus", loopCpus, err) || !CheckCpuList("worker_cpus", workerCpus, err) ||
+       !CheckCpuList("log_cpus", logCpus, err)) {
+        return false;
+    }
+    if(bufferMax < bufferSize) {
+        *err = "buffer_max must not be smaller than buffer_size";
+        return false;
+    }
+    if(logOverflow != "drop_newest" && logOverflow != "drop_oldest" && logOverflow != "sample" &&
+       logOverflow != "block") {
+        *err = "log_overflow must be drop_newest, drop_oldest, sample or block: " + logOverflow;
+        return false;
+    }
+    if(accessLogFormat != "common" && accessLogFormat != "json") {
+        *err = "access_log_format must be common or json: " + accessLogFormat;
+        return false;
+    }
+    if(openLog && logDir.empty()) {
+        *err = "log_dir is empty";
+        return false;
+    }
+    return true;
+}
+
+void Config::ApplyLive(const Config& next, vector<string>* restart) {
+    for(auto& opt: OPTIONS) {
+        if(OptionValue(*this, opt) == OptionValue(next, opt)) { continue; }
+        if(opt.reload == RESTART) {
+            restart->push_back(opt.name);
+            continue;
+        }
+        switch(opt.type) {
+        case INT: this->*opt.intVal = next.*opt.intVal; break;
+        case BOOL: this->*opt.boolVal = next.*opt.boolVal; break;
+        default: this->*opt.strVal = next.*opt.strVal; break;
+        }
+    }
+}
+
+void Config::Dump() const {
+    LOG_INFO("Config file: %s", configPath.empty() ? "none" : configPath.c_str());
+    for(auto& opt: OPTIONS) {
+        // 不把密码写进日志
+        string value = opt.strVal == &Config::sqlPwd ? "******" : OptionValue(*this, opt);
+        LOG_INFO("  %s = %s", opt.name, value.c_str());
+    }
+}
+
+string Config::Usage(const char* prog) {
+    Config def;
+    string out = string("usage: ") + prog + " [--config=FILE] [--takeover] [--key=value ...]\n"
+                 "config file lines are 'key = value', command line options override them\n"
+                 "boolean options may be given as a bare --key, meaning true\n"
+                 "  --takeover  inherit the listen socket from a running server through handoff_path\n";
+    char line[256];
+    for(auto& opt: OPTIONS) {
+        snprintf(line, sizeof(line), "  --%-18s %s (default: %s)\n", opt.name, opt.help,
+                    OptionValue(def, opt).c_str());
+        out += line;
+    }
+    return out;
+}
@@ -2,4 +2,130 @@
  * @Author       : mark
  * @Date         : 2020-06-28
  * @copyleft Apache 2.0
- */ 
+ */
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// 服务器的所有可调参数
+// 先取默认值，再读配置文件(key = value，#开头是注释)，最后用命令行的--key=value覆盖，
+// 启动时统一校验，改参数做压测不用重新编译
+class Config {
+public:
+    Config() = default;
+
+    // 解析命令行：--config=文件 --key=value --takeover --help，布尔参数只写--key表示打开
+    // 返回false时err里是错误信息，help为true表示只需要打印帮助
+    bool Load(int argc, char* argv[], std::string* err);
+
+    // 重新读一遍配置文件，再应用一次命令行覆盖的值，用于SIGHUP
+    bool Reload(std::string* err);
+
+    // 设置一个参数，key不存在或者值不合法时返回false
+    bool Set(const std::string& key, const std::string& value, std::string* err);
+
+    // 检查参数范围和参数之间的约束
+    bool Validate(std::string* err) const;
+
+    // 重新加载用：next里能在运行时生效的参数拷过来，需要重启的参数有变化时只把名字放进restart
+    void ApplyLive(const Config& next, std::vector<std::string>* restart);
+
+    // 把所有参数写进日志
+    void Dump() const;
+
+    // 帮助信息，列出所有参数及默认值
+    static std::string Usage(const char* prog);
+
+    /* 网络 */
+    int port = 1316;            // 端口
+    std::string listen;         // 监听地址列表，逗号分隔，为空表示0.0.0.0:port，见listenaddr.h
+    bool ipv6Only = false;      // IPv6监听套接字只收IPv6，关掉时[::]同时接受IPv4(双栈)
+    int trigMode = 3;           // 0:LT+LT 1:LT+ET 2:ET+LT 3:ET+ET (监听+连接)
+    int timeoutMs = 60000;      // 空闲连接超时，0表示不超时
+    bool optLinger = false;     // 优雅关闭
+    int backlog = 1024;         // listen的全连接队列长度
+    bool tcpNoDelay = true;     // 关闭Nagle，小响应不用等对方的ACK
+    std::string coalesce = "more";  // 响应头和文件怎么合包 more: MSG_MORE cork: TCP_CORK off: 不处理
+    int deferAcceptSec = 0;     // TCP_DEFER_ACCEPT，收到数据才accept，最多等这么多秒，0表示关闭
+    int fastOpen = 0;           // TCP_FASTOPEN的队列长度，0表示关闭
+    int sndBuf = 0;             // 连接的发送缓冲区大小，0表示用内核的默认值(自动调节)
+    int rcvBuf = 0;             // 连接的接收缓冲区大小，0表示用内核的默认值(自动调节)
+
+    /* 数据库 */
+    std::string sqlHost = "localhost";
+    int sqlPort = 3306;
+    std::string sqlUser = "root";
+    std::string sqlPwd = "root";
+    std::string dbName = "webserver";
+    int connPoolNum = 12;       // 数据库连接池数量
+    bool sqlStub = false;       // 不连数据库，用内存里的用户表(有bench/bench)代替，压测用
+
+    /* 线程与缓冲区 */
+    int threadNum = 6;          // 线程池数量
+    int bufferSize = 1024;      // 每个连接读写缓冲区的初始大小
+    int bufferMax = 2 * 1024 * 1024;    // 每个连接读缓冲区的上限
+
+    /* 绑核，CPU列表的格式和taskset一样，比如"0-3,8"，为空表示不绑 */
+    std::string loopCpus;       // 事件循环线程
+    std::string workerCpus;     // 工作线程，轮流绑定到列表里的CPU上
+    std::string logCpus;        // 日志写线程
+    bool numaLocal = false;     // 绑核的线程优先从所在的NUMA节点分配内存
+
+    /* 日志 */
+    bool openLog = true;        // 日志开关
+    int logLevel = 1;           // 日志等级
+    int logQueSize = 1024;      // 日志异步队列容量，0表示同步写
+    std::string logDir = "./log";
+    int logMaxMb = 64;          // 单个日志文件的大小上限，0表示只按天切分
+    bool logCompress = false;   // 切下来的日志文件用gzip压缩
+    std::string logOverflow = "drop_newest";   // 异步队列满了：drop_newest、drop_oldest、sample或block
+
+    /* 访问日志 */
+    std::string accessLog;      // 访问日志文件，为空表示关闭
+    std::string accessLogFormat = "common";    // common或json
+    int accessLogSample = 1;    // 成功的请求每N个记一个，出错的都记
+    int accessLogMaxMb = 0;     // 文件超过这么大就切分，0表示不按大小切分
+    int accessLogRotateSec = 0; // 每隔这么多秒切分一次，0表示不按时间切分
+    int accessLogFlushMs = 200; // 记录最多在内存里攒这么久
+
+    /* 管理路径 */
+    std::string adminAccess = "local";  // /__stats和/__trace谁能访问，off: 都不能 local: 只有本机 all: 所有人
+
+    /* 跟踪 */
+    bool trace = false;         // 按阶段记录请求耗时，可以重新加载配置来开关
+
+    /* 资源 */
+    std::string srcDir;         // 资源目录，为空表示当前目录下的resources/
+    int fileCache = 1024;       // 缓存打开的文件和stat结果的条数，0表示不缓存
+    bool fileCacheInotify = true;   // 用inotify监视资源目录，文件变了马上失效
+    int fileCacheRevalidateMs = 0;  // 缓存的条目过了这么久重新打开，0表示只靠inotify失效
+    bool preload = false;       // 启动时把资源目录打包进内存镜像，连同响应头
+    int preloadMaxMb = 64;      // 镜像最大的大小
+    int preloadMaxFileKb = 1024;    // 比这大的文件不预加载
+
+    /* 过载保护 */
+    int maxQueue = 10000;       // 线程池排队任务数上限
+    int maxInflight = 0;        // 在途读写任务数上限
+    int maxLoopLagMs = 500;     // 事件循环一轮耗时上限
+    int maxConnPerIp = 0;       // 单个ip的连接数上限
+    std::string overloadMode = "shed";  // shed: 回复503 pause: 暂停accept
+
+    /* 退出与重启 */
+    int drainTimeoutMs = 30000; // 排空连接最多等待的时间
+    std::string handoffPath = "./webserver.sock";  // 交接监听套接字的控制套接字，为空表示关闭
+    bool takeover = false;      // 启动时从旧进程接管监听套接字
+
+    bool help = false;          // 只打印帮助
+    std::string configPath;     // 配置文件路径
+
+private:
+    bool LoadFile_(const std::string& path, std::string* err);
+
+    // 命令行覆盖的参数，重新加载时要再应用一次
+    std::vector<std::pair<std::string, std::string>> overrides_;
+};
+
+#endif //CONFIG_H
@@ -0,0 +1,37 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-25
+ * @copyleft Apache 2.0
+ */
+#ifndef CONST_TABLE_H
+#define CONST_TABLE_H
+
+#include <algorithm>
+#include <cstddef>
+
+/* 编译期生成的有序查找表
+ * 表项是带有key成员的聚合体，定义成constexpr数组，
+ * 用IsSortedTable在编译期static_assert校验有序，运行时二分查找，
+ * 不需要在静态初始化时建哈希表，也不会每次请求构造std::string去哈希 */
+
+// 编译期检查表是否按key严格递增(同时保证key不重复)
+template<class Entry, size_t N>
+constexpr bool IsSortedTable(const Entry (&table)[N]) {
+    for(size_t i = 1; i < N; i++) {
+        if(!(table[i - 1].key < table[i].key)) { return false; }
+    }
+    return true;
+}
+
+// 二分查找key，找不到返回nullptr
+template<class Entry, size_t N, class Key>
+const Entry* FindInTable(const Entry (&table)[N], const Key& key) {
+    const Entry* it = std::lower_bound(table, table + N, key,
+        [](const Entry& e, const Key& k) { return e.key < k; });
+    if(it != table + N && it->key == key) {
+        return it;
+    }
+    return nullptr;
+}
+
+#endif //CONST_TABLE_H
@@ -0,0 +1,269 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-27
+ * @copyleft Apache 2.0
+ */
+#include "filecache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include "../log/log.h"
+
+using namespace std;
+
+namespace {
+
+int64_t NowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// 文件内容、大小、权限变化，文件或目录的增删改名
+const uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+} // namespace
+
+FileCache* FileCache::Instance() {
+    static FileCache inst;
+    return &inst;
+}
+
+FileCache::~FileCache() {
+    Close();
+}
+
+void FileCache::Init(size_t capacity, int revalidateMs) {
+    Clear();
+    shardCapacity_ = (capacity + SHARDS - 1) / SHARDS;
+    revalidateMs_ = revalidateMs;
+}
+
+// 打开失败时用stat区分没有权限(403)和不存在(404)
+// 描述符用完了之类的临时错误不缓存，下次再试
+bool FileCache::Load_(const string& path, Entry* entry) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        int err = errno;
+        entry->exists = stat(path.c_str(), &entry->st) == 0;
+        if(!entry->exists) { entry->st = {}; }
+        return err == ENOENT || err == ENOTDIR || err == EACCES || err == ENAMETOOLONG || err == ELOOP;
+    }
+    entry->file = make_shared<WriteQueue::FileRef>(fd);
+    if(fstat(fd, &entry->st) < 0) {
+        entry->file.reset();
+        entry->exists = false;
+        entry->st = {};
+        return false;
+    }
+    entry->exists = true;
+    // 目录和不让读的文件不留描述符
+    if(!S_ISREG(entry->st.st_mode) || !(entry->st.st_mode & S_IROTH)) {
+        entry->file.reset();
+    }
+    return true;
+}
+
+bool FileCache::Lookup(const string& path, shared_ptr<WriteQueue::FileRef>* file, struct stat* st) {
+    Node node;
+    if(shardCapacity_ == 0) {
+        Load_(path, &node.entry);
+        *file = std::move(node.entry.file);
+        *st = node.entry.st;
+        return node.entry.exists;
+    }
+    Shard& shard = ShardOf_(path);
+    int revalidateMs = revalidateMs_.load(memory_order_relaxed);
+    int64_t now = revalidateMs > 0 ? NowMs() : 0;
+    uint64_t gen;
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.index.find(path);
+        if(it != shard.index.end() && (revalidateMs <= 0 || now - it->second->loadedMs < revalidateMs)) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            shard.hits++;
+            const Entry& entry = it->second->entry;
+            *file = entry.file;
+            *st = entry.st;
+            return entry.exists;
+        }
+        shard.misses++;
+        gen = shard.gen;
+    }
+    // 不在锁里打开文件，同一个路径同时没命中时会多打开几次，结果一样
+    bool cacheable = Load_(path, &node.entry);
+    *file = node.entry.file;
+    *st = node.entry.st;
+    bool exists = node.entry.exists;
+    if(!cacheable) { return exists; }
+    node.path = path;
+    node.loadedMs = now;
+    lock_guard<mutex> locker(shard.mtx);
+    if(shard.gen != gen) { return exists; }
+    auto it = shard.index.find(path);
+    if(it != shard.index.end()) {
+        // 过期的旧条目，键指向节点里的字符串，先从索引里删
+        auto old = it->second;
+        shard.index.erase(it);
+        shard.lru.erase(old);
+    }
+    shard.lru.push_front(std::move(node));
+    shard.index.emplace(shard.lru.front().path, shard.lru.begin());
+    if(shard.lru.size() > shardCapacity_) {
+        shard.index.erase(shard.lru.back().path);
+        shard.lru.pop_back();
+    }
+    return exists;
+}
+
+void FileCache::Invalidate(string_view path) {
+    Shard& shard = ShardOf_(path);
+    lock_guard<mutex> locker(shard.mtx);
+    shard.gen++;
+    auto it = shard.index.find(path);
+    if(it == shard.index.end()) { return; }
+    auto node = it->second;
+    shard.index.erase(it);
+    shard.lru.erase(node);
+}
+
+void FileCache::Clear() {
+    for(auto& shard: shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        shard.gen++;
+        shard.index.clear();
+        shard.lru.clear();
+    }
+}
+
+int FileCache::Watch(const string& root) {
+    Close();
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotifyFd_ < 0) { return -1; }
+    root_ = root;
+    if(!AddWatch_("")) {
+        // 目录太多超过了max_user_watches，不完整的监视没有意义
+        Close();
+        return -1;
+    }
+    LOG_INFO("File cache watching %zu directories under %s", dirs_.size(), root_.c_str());
+    return inotifyFd_;
+}
+
+bool FileCache::AddWatch_(const string& rel) {
+    string dir = root_ + rel;
+    int wd = inotify_add_watch(inotifyFd_, dir.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if(wd < 0) {
+        LOG_WARN("inotify watch %s error: %d", dir.c_str(), errno);
+        return false;
+    }
+    dirs_[wd] = rel;
+    DIR* dp = opendir(dir.c_str());
+    if(!dp) { return true; }
+    bool ok = true;
+    while(dirent* ent = readdir(dp)) {
+        string name = ent->d_name;
+        if(name == "." || name == "..") { continue; }
+        bool isDir = ent->d_type == DT_DIR;
+        if(ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            isDir = lstat((dir + "/" + name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if(isDir && !AddWatch_(rel + "/" + name)) {
+            ok = false;
+            break;
+        }
+    }
+    closedir(dp);
+    return ok;
+}
+
+// 文件的事件只去掉这个路径；目录的增删改名影响下面所有的路径，整个清空
+bool FileCache::DealEvents() {
+    alignas(struct inotify_event) char buf[4096];
+    bool changed = false;
+    while(true) {
+        ssize_t n = read(inotifyFd_, buf, sizeof(buf));
+        if(n <= 0) { break; }
+        for(char* p = buf; p < buf + n; ) {
+            const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+            if(ev->mask & IN_Q_OVERFLOW) {
+                LOG_WARN("inotify queue overflow, file cache cleared");
+                Clear();
+                changed = true;
+                continue;
+            }
+            auto it = dirs_.find(ev->wd);
+            if(it == dirs_.end()) { continue; }
+            if(ev->mask & IN_IGNORED) {
+                dirs_.erase(it);
+                continue;
+            }
+            changed = true;
+            if(ev->mask & IN_MOVE_SELF) {
+                // 改名以后记的相对路径不对了，新位置由父目录的IN_MOVED_TO重新监视
+                if(!it->second.empty()) {
+                    inotify_rm_watch(inotifyFd_, ev->wd);
+                    dirs_.erase(it);
+                }
+                Clear();
+                continue;
+            }
+            if(ev->mask & IN_DELETE_SELF) {
+                Clear();
+                continue;
+            }
+            if(ev->len == 0) { continue; }
+            string rel = it->second + "/" + ev->name;
+            if(ev->mask & IN_ISDIR) {
+                Clear();
+                if(ev->mask & (IN_CREATE | IN_MOVED_TO)) { AddWatch_(rel); }
+                continue;
+            }
+            Invalidate(root_ + rel);
+        }
+    }
+    return changed;
+}
+
+void FileCache::Close() {
+    if(inotifyFd_ >= 0) {
+        close(inotifyFd_);
+        inotifyFd_ = -1;
+    }
+    dirs_.clear();
+    Clear();
+}
+
+uint64_t FileCache::Hits() const {
+    uint64_t total = 0;
+    for(auto& shard: shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        total += shard.hits;
+    }
+    return total;
+}
+
+uint64_t FileCache::Misses() const {
+    uint64_t total = 0;
+    for(auto& shard: shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        total += shard.misses;
+    }
+    return total;
+}
+
+size_t FileCache::Size() const {
+    size_t total = 0;
+    for(auto& shard: shards_) {
+        lock_guard<mutex> locker(shard.mtx);
+        total += shard.lru.size();
+    }
+    return total;
+}
@@ -0,0 +1,93 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-27
+ * @copyleft Apache 2.0
+ */
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#include "../buffer/writequeue.h"
+
+// 打开的文件描述符和stat结果的LRU缓存，键是完整路径(资源目录 + 请求路径)，
+// 命中时生成响应不需要任何解析路径的系统调用；不存在的路径也缓存，404页面不用每次都stat两遍。
+// 描述符由FileRef持有，被淘汰或者失效时已经入队的响应还拿着引用，发完才关闭；
+// sendfile带偏移量，不改文件的读写位置，所以多个连接可以同时发同一个描述符。
+// 失效有两种方式：inotify监视资源目录，文件一变马上去掉；或者条目存在超过revalidateMs后重新打开。
+// 按路径的哈希分片，每个分片一把锁和一条LRU链表
+class FileCache {
+public:
+    static FileCache* Instance();
+
+    // capacity为0表示不缓存，每次都直接打开；revalidateMs为0表示条目一直有效，只靠inotify失效
+    void Init(size_t capacity, int revalidateMs);
+    void SetRevalidateMs(int ms) { revalidateMs_.store(ms, std::memory_order_relaxed); }
+    int RevalidateMs() const { return revalidateMs_.load(std::memory_order_relaxed); }
+
+    // 查找path，存在时返回true，st是它的状态；可读的普通文件同时给出打开的文件，其他情况file为空
+    bool Lookup(const std::string& path, std::shared_ptr<WriteQueue::FileRef>* file, struct stat* st);
+
+    void Invalidate(std::string_view path);   // 去掉一个路径
+    void Clear();                             // 去掉所有的条目
+
+    // 用inotify递归监视root下所有的目录，返回的描述符放进主线程的epoll，可读时调用DealEvents
+    // root和生成键时用的资源目录要一样；失败返回-1
+    int Watch(const std::string& root);
+    bool DealEvents();  // 有文件或目录变了返回true
+    void Close();   // 关闭inotify，清空缓存
+
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+    size_t Size() const;
+
+private:
+    struct Entry {
+        bool exists = false;
+        struct stat st = {};
+        std::shared_ptr<WriteQueue::FileRef> file;
+    };
+
+    struct Node {
+        std::string path;
+        Entry entry;
+        int64_t loadedMs;   // 打开的时间，单调时钟
+    };
+
+    struct Shard {
+        mutable std::mutex mtx;
+        std::list<Node> lru;    // 最近用过的在前面
+        std::unordered_map<std::string_view, std::list<Node>::iterator> index;  // 键指向节点里的path
+        uint64_t gen = 0;       // 每次失效加一，打开文件期间有失效的话结果不放进缓存
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    FileCache() = default;
+    ~FileCache();
+
+    Shard& ShardOf_(std::string_view path) { return shards_[std::hash<std::string_view>()(path) % SHARDS]; }
+    static bool Load_(const std::string& path, Entry* entry);  // 打开文件，结果可以缓存时返回true
+    bool AddWatch_(const std::string& rel);     // 监视root_ + rel和它下面所有的目录
+
+    static const size_t SHARDS = 16;
+
+    size_t shardCapacity_ = 0;  // 每个分片最多的条目数，0表示不缓存
+    std::atomic<int> revalidateMs_{0};
+    Shard shards_[SHARDS];
+
+    // inotify只在主线程里用
+    int inotifyFd_ = -1;
+    std::string root_;
+    std::unordered_map<int, std::string> dirs_;     // watch描述符 - 相对root_的目录，根目录是空串
+};
+
+#endif //FILE_CACHE_H
@@ -0,0 +1,60 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-25
+ * @copyleft Apache 2.0
+ */ 
+#include "headermap.h"
+
+using namespace std;
+
+// 只比较ASCII，请求头的名字里不会有别的字符
+bool HeaderMap::EqualsIgnoreCase(string_view a, string_view b) {
+    if(a.size() != b.size()) { return false; }
+    for(size_t i = 0; i < a.size(); i++) {
+        char x = a[i], y = b[i];
+        if(x == y) { continue; }
+        if((x | 0x20) != (y | 0x20) || (x | 0x20) < 'a' || (x | 0x20) > 'z') { return false; }
+    }
+    return true;
+}
+
+// 先按长度分，每个长度最多只要比一次
+HeaderMap::KNOWN HeaderMap::Classify(string_view name) {
+    switch(name.size()) {
+    case 4:  return EqualsIgnoreCase(name, "Host") ? HOST : UNKNOWN;
+    case 5:  return EqualsIgnoreCase(name, "Range") ? RANGE : UNKNOWN;
+    case 10: return EqualsIgnoreCase(name, "Connection") ? CONNECTION : UNKNOWN;
+    case 12: return EqualsIgnoreCase(name, "Content-Type") ? CONTENT_TYPE : UNKNOWN;
+    case 13: return EqualsIgnoreCase(name, "If-None-Match") ? IF_NONE_MATCH : UNKNOWN;
+    case 14: return EqualsIgnoreCase(name, "Content-Length") ? CONTENT_LENGTH : UNKNOWN;
+    case 15: return EqualsIgnoreCase(name, "Accept-Encoding") ? ACCEPT_ENCODING : UNKNOWN;
+    case 17: return EqualsIgnoreCase(name, "Transfer-Encoding") ? TRANSFER_ENCODING : UNKNOWN;
+    default: return UNKNOWN;
+    }
+}
+
+void HeaderMap::Clear() {
+    overflow_.clear();
+    count_ = 0;
+    for(auto& value: known_) { value = string_view(); }
+}
+
+void HeaderMap::Add(string_view name, string_view value) {
+    // 值为空的请求头也要和没有区分开
+    if(!value.data()) { value = string_view(name.data() + name.size(), 0); }
+    if(count_ < INLINE_SIZE) { inline_[count_] = Field(name, value); }
+    else { overflow_.emplace_back(name, value); }
+    count_++;
+    KNOWN id = Classify(name);
+    if(id != UNKNOWN && !Has(id)) { known_[id] = value; }
+}
+
+string_view HeaderMap::Get(string_view name) const {
+    KNOWN id = Classify(name);
+    if(id != UNKNOWN) { return known_[id]; }
+    for(size_t i = 0; i < count_; i++) {
+        const Field& field = At(i);
+        if(EqualsIgnoreCase(field.first, name)) { return field.second; }
+    }
+    return string_view();
+}
@@ -0,0 +1,60 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-25
+ * @copyleft Apache 2.0
+ */ 
+#ifndef HEADER_MAP_H
+#define HEADER_MAP_H
+
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <stddef.h>
+
+// 请求头，名字和值都是指向arena的视图
+// 一般的请求不到16个请求头，直接放在对象里的数组中，顺序查找比哈希表快，超过了才放到vector里；
+// 常用的几个请求头在添加时就归好类，查找是O(1)；名字不区分大小写
+class HeaderMap {
+public:
+    // 预先归类的请求头
+    enum KNOWN {
+        CONNECTION = 0,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        HOST,
+        RANGE,
+        IF_NONE_MATCH,
+        ACCEPT_ENCODING,
+        TRANSFER_ENCODING,
+        KNOWN_COUNT,
+        UNKNOWN = KNOWN_COUNT,
+    };
+    typedef std::pair<std::string_view, std::string_view> Field;
+
+    HeaderMap(): count_(0) {}
+
+    void Clear();
+    // 添加一个请求头，同名的常用请求头以第一个为准
+    void Add(std::string_view name, std::string_view value);
+
+    std::string_view Get(KNOWN id) const { return known_[id]; }
+    bool Has(KNOWN id) const { return known_[id].data() != nullptr; }
+    std::string_view Get(std::string_view name) const;   // 没有时返回空
+
+    size_t Size() const { return count_; }
+    const Field& At(size_t i) const { return i < INLINE_SIZE ? inline_[i] : overflow_[i - INLINE_SIZE]; }
+
+    // 归类，不是常用的请求头返回UNKNOWN
+    static KNOWN Classify(std::string_view name);
+    static bool EqualsIgnoreCase(std::string_view a, std::string_view b);
+
+private:
+    static const size_t INLINE_SIZE = 16;
+
+    Field inline_[INLINE_SIZE];     // 前16个请求头
+    std::vector<Field> overflow_;   // 多出来的，clear后容量还在
+    size_t count_;
+    std::string_view known_[KNOWN_COUNT];   // 常用请求头的值
+};
+
+#endif //HEADER_MAP_H
@@ -9,128 +9,233 @@ using namespace std;
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
+std::atomic<bool> HttpConn::isDraining;
+int HttpConn::bufferSize = 1024;
+int HttpConn::bufferMax = 2 * 1024 * 1024;
+bool HttpConn::msgMore = true;
+bool HttpConn::tcpCork = false;
+HttpConn::ADMIN_ACCESS HttpConn::adminAccess = HttpConn::ADMIN_LOCAL;
 
-HttpConn::HttpConn() { 
+HttpConn::HttpConn(): readBuff_(bufferSize), writeBuff_(bufferSize), request_(&arena_) { 
     fd_ = -1;
-    addr_ = { 0 };
     isClose_ = true;
+    busy_ = false;
+    finished_ = true;
+    acceptUs_ = reqStartUs_ = 0;
+    firstByteSent_ = false;
+    pendingCnt_ = 0;
+    reuse_ = 0;
+    readHint_ = MIN_READ_HINT;
+    readBuff_.SetMaxSize(bufferMax);
 };
 
 HttpConn::~HttpConn() { 
     Close(); 
 };
 // 初始化http连接,重置writeBuff_和readBuff_缓冲区
-void HttpConn::init(int fd, const sockaddr_in& addr) {
+void HttpConn::init(int fd, const sockaddr* addr, socklen_t addrLen) {
     assert(fd > 0);
     userCount++;
-    addr_ = addr;
+    peer_.Set(addr, addrLen);
     fd_ = fd;
+    queue_.Clear();
+    queue_.SetMsgMore(msgMore);
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
+    // 上一个用这个fd的连接可能因为请求太大被关掉，缓冲区还是大的
+    writeBuff_.Shrink(bufferSize);
+    readBuff_.Shrink(bufferSize);
+    request_.Init();
+    readHint_ = MIN_READ_HINT;
+    acceptUs_ = Metrics::NowUs();
+    reqStartUs_ = 0;
+    firstByteSent_ = false;
+    pendingCnt_ = 0;
+    reuse_ = 0;
+    busy_ = false;
+    finished_ = false;
     isClose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 // 关闭连接
-void HttpConn::Close() {
-    response_.UnmapFile();
-    if(isClose_ == false){
-        isClose_ = true; 
-        userCount--;
-        close(fd_);
-        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
-    }
+// 定时器可能在主线程上关闭一个正在被子线程处理的连接，这时fd_一关，主线程马上就可能accept到同一个fd号，
+// 在这个对象上init新连接，子线程却还在用它。所以只shutdown让子线程的读写尽快出错返回，由它在EndTask里关闭
+bool HttpConn::Close() {
+    if(isClose_.exchange(true)) { return false; }
+    if(busy_) { shutdown(fd_, SHUT_RDWR); }
+    return Finish_();
+}
+// 先清掉busy_再看isClose_，和Close的顺序相反，两边至少有一边会去关闭
+bool HttpConn::EndTask() {
+    busy_ = false;
+    return isClose_ && Finish_();
+}
+
+bool HttpConn::Finish_() {
+    if(busy_ || finished_.exchange(true)) { return false; }
+    userCount--;
+    // 关闭以后fd可能马上被新连接复用，init会改写对端地址，所以先打日志再关
+    LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+    response_.CloseFile();
+    queue_.Clear();
+    close(fd_);
+    return true;
 }
 // 获取fd_
 
 int HttpConn::GetFd() const {
     return fd_;
 };
-//获取addr_
-struct sockaddr_in HttpConn::GetAddr() const {
-    return addr_;
-}
-//
+// 获取ip地址，日志级别关掉时不会走到这里，也就不用格式化
 const char* HttpConn::GetIP() const {
-    return inet_ntoa(addr_.sin_addr);
+    return peer_.Ip();
 }
 // 获取端口号
 int HttpConn::GetPort() const {
-    return addr_.sin_port;
+    return peer_.Port();
 }
 
 // 从（请求）缓冲区读数据，读到readBuff_中
 ssize_t HttpConn::read(int* saveErrno) {
     ssize_t len = -1;
+    size_t total = 0;
+    Trace::Span span(Trace::READ, fd_);
     do {
         // 从（请求）缓冲区读数据，读到readBuff_中
-        len = readBuff_.ReadFd(fd_, saveErrno);
+        len = readBuff_.ReadFd(fd_, saveErrno, readHint_);
         if (len <= 0) {
             break;
         }
+        total += len;
+        Metrics::Add(Metrics::BYTES_IN, len);
+        if(reqStartUs_ == 0) { reqStartUs_ = Metrics::NowUs(); }
     } while (isET);
+    // 记下这个连接一次大概读多少，下次缓冲区空间比它小时按实际数据量扩容
+    if(total > 0) {
+        readHint_ = (readHint_ * 3 + total) / 4;
+        if(readHint_ < MIN_READ_HINT) { readHint_ = MIN_READ_HINT; }
+    }
     return len;
 }
 
-// 将http响应信息写入到响应缓冲区，给客户端
+// 把发送队列里的响应写给客户端
+// LT和ET都写到队列空或者EAGAIN为止，没写完的部分记在队列里，等下次可写接着写
 ssize_t HttpConn::write(int* saveErrno) {
-    ssize_t len = -1;
-    do {
-        len = writev(fd_, iov_, iovCnt_);
-        if(len <= 0) {
-            *saveErrno = errno;
+    size_t written = 0;
+    int on = 1;
+    Trace::Span span(Trace::WRITE, fd_);
+    if(tcpCork) { setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)); }
+    bool done = queue_.Flush(fd_, saveErrno, &written);
+    // 没写完时保持CORK，等下次可写接着攒，写完了拔掉塞子把最后不满一个包的数据发出去
+    if(tcpCork && done) {
+        on = 0;
+        setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    }
+    if(written > 0) {
+        Metrics::Add(Metrics::BYTES_OUT, written);
+        if(!firstByteSent_) {
+            firstByteSent_ = true;
+            Metrics::Observe(Metrics::FIRST_BYTE, Metrics::NowUs() - acceptUs_);
+        }
+    }
+    if(!done) {
+        return -1;
+    }
+    if(pendingCnt_ > 0) { FlushPending_(); }
+    // 响应全部写完了，记录整个请求的耗时
+    if(reqStartUs_ > 0) {
+        Metrics::Observe(Metrics::REQUEST_TIME, Metrics::NowUs() - reqStartUs_);
+        reqStartUs_ = 0;
+    }
+    // 一个大请求或者大响应过后把多占的内存还回去，长连接空闲时不会一直占着
+    size_t keep = static_cast<size_t>(bufferSize);
+    if(writeBuff_.Capacity() > keep * SHRINK_RATIO) { writeBuff_.Shrink(keep); }
+    if(readBuff_.Capacity() > keep * SHRINK_RATIO) { readBuff_.Shrink(keep); }
+    return written;
+}
+
+// 处理业务逻辑，这个时候数据已经写入readBuff_里面了
+bool HttpConn::process() {
+    int count = 0;
+    while(count < MAX_PIPELINE && readBuff_.ReadableBytes() > 0) {
+        // 长连接上缓冲区里剩下的请求没有经过read，在这里开始计时
+        if(reqStartUs_ == 0) { reqStartUs_ = Metrics::NowUs(); }
+        // 用request来解析readBuff_中的数据，请求不完整时接着读，解析状态留在request_里
+        HttpRequest::HTTP_CODE ret;
+        {
+            Trace::Span span(Trace::PARSE, fd_);
+            ret = request_.parse(readBuff_);
+        }
+        if(ret == HttpRequest::NO_REQUEST) {
             break;
         }
-        if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
-        // 表示iov_[0]这块缓冲区的内容传完了，但是iov_[1]这块缓冲区传了一些华美传完
-        else if(static_cast<size_t>(len) > iov_[0].iov_len) {
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            // 清空iov_[0]，避免下次会再传
-            if(iov_[0].iov_len) {
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
+        if(ret == HttpRequest::GET_REQUEST) {
+            LOG_DEBUG("%.*s", (int)request_.path().size(), request_.path().data());
+            //解析完后就开始初始化封装response了
+            response_.Init(srcDir, request_.path(), request_.IsKeepAlive() && !isDraining, 200);
+        } else {
+            Metrics::Add(Metrics::PARSE_ERRORS);
+            response_.Init(srcDir, request_.path(), false, 400);
+        }
+        // 响应头和内存里生成的body追加在writeBuff_后面，前面的响应可能还在队列里
+        size_t before = writeBuff_.ReadableBytes();
+        {
+            Trace::Span span(Trace::RESPONSE, fd_);
+            if(response_.Code() == 200 && request_.path() == Metrics::STATS_PATH && AdminAllowed_()) {
+                // 保留的统计路径，不走文件
+                response_.MakeResponse(writeBuff_, "text/plain; version=0.0.4", Metrics::Instance()->Render());
+            } else if(response_.Code() == 200 && request_.path() == Trace::TRACE_PATH &&
+                      Trace::Enabled() && AdminAllowed_()) {
+                // 关掉trace时不导出，留着的是旧数据
+                response_.MakeResponse(writeBuff_, "application/json", Trace::Instance()->RenderChrome());
+            } else {
+                response_.MakeResponse(writeBuff_);
             }
         }
-        else {
-            // 表示连iov_[0]都没有传完，只传了一些
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len; 
-            iov_[0].iov_len -= len; 
-            writeBuff_.Retrieve(len);
+        Metrics::Add(Metrics::REQUESTS);
+        Metrics::CountStatus(response_.Code());
+        size_t headBytes = writeBuff_.ReadableBytes() - before;
+        if(AccessLog::Instance()->IsOpen() && AccessLog::Instance()->ShouldRecord(response_.Code())) {
+            AddPending_(headBytes + response_.FileLen());
         }
-    } while(isET || ToWriteBytes() > 10240);
-    return len;
+        reuse_++;
+        queue_.AppendBuffer(&writeBuff_, headBytes);
+        LOG_DEBUG("filesize:%zu, %zu to write", response_.FileLen(), ToWriteBytes() + response_.FileLen());
+        /* 文件 */
+        response_.QueueFile(queue_);
+        count++;
+        // 要关闭的连接后面的请求不再处理
+        if(!IsKeepAlive()) { break; }
+    }
+    // 这个时候响应头和响应数据封装好了，但是还没有写回给客户端
+    return count > 0;
 }
 
-// 处理业务逻辑，这个时候数据已经写入readBuff_里面了
-bool HttpConn::process() {
-    // 初始化request_对象
-    request_.Init();
-    // 判断readBuff_是否有数据可读
-    if(readBuff_.ReadableBytes() <= 0) {
-        return false;
-    }
-    // 用request来解析readBuff_中的数据
-    else if(request_.parse(readBuff_)) {
-        LOG_DEBUG("%s", request_.path().c_str());
-        //解析完后就开始初始化封装response了
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
-    } else {
-        response_.Init(srcDir, request_.path(), false, 400);
-    }
-    // 生成的相应数据都在这,都保存再writeBuff_里面
-    response_.MakeResponse(writeBuff_);
-    /* 响应头 */
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
+bool HttpConn::AdminAllowed_() const {
+    if(adminAccess == ADMIN_ALL) { return true; }
+    return adminAccess == ADMIN_LOCAL && peer_.IsLoopback();
+}
 
-    /* 文件 */
-    if(response_.FileLen() > 0  && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+void HttpConn::AddPending_(uint64_t bytes) {
+    if(pendingCnt_ == pending_.size()) { pending_.emplace_back(); }
+    Pending& item = pending_[pendingCnt_++];
+    item.method.assign(request_.method());
+    item.path.assign(request_.path());
+    item.version.assign(request_.version());
+    item.status = response_.Code();
+    item.bytes = bytes;
+    item.startUs = reqStartUs_;
+    item.reuse = reuse_;
+}
+
+void HttpConn::FlushPending_() {
+    uint64_t now = Metrics::NowUs();
+    AccessLog* log = AccessLog::Instance();
+    for(size_t i = 0; i < pendingCnt_; i++) {
+        const Pending& item = pending_[i];
+        AccessLog::Entry entry = { GetIP(), item.method, item.path, item.version, item.status,
+                                   item.bytes, item.startUs > 0 ? now - item.startUs : 0, item.reuse };
+        log->Record(entry);
     }
-    // 这个时候响应头和响应数据封装好了，但是还没有写回给客户端
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
+    pendingCnt_ = 0;
 }
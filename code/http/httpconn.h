@@ -9,15 +9,22 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
-#include <arpa/inet.h>   // sockaddr_in
+#include <sys/socket.h>  // sockaddr
+#include <netinet/tcp.h> // TCP_CORK
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
 
 #include "../log/log.h"
+#include "../log/accesslog.h"
 #include "../pool/sqlconnRAII.h"
 #include "../buffer/buffer.h"
+#include "../buffer/arena.h"
+#include "../buffer/writequeue.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "peeraddr.h"
 
 class HttpConn {
 public:
@@ -25,51 +32,107 @@ public:
 
     ~HttpConn();  // 
 
-    void init(int sockFd, const sockaddr_in& addr);  // 初始化http连接
+    void init(int sockFd, const sockaddr* addr, socklen_t addrLen);  // 初始化http连接
 
     ssize_t read(int* saveErrno);  // 从（请求）缓冲区读数据，读到readBuff_中
 
-    ssize_t write(int* saveErrno);  // 将http响应信息写入到响应缓冲区，给客户端
+    // 把发送队列里的响应写给客户端，写到队列空或者socket写满为止，
+    // 写完了返回写出的字节数，没写完返回-1，saveErrno是EAGAIN表示等下次可写
+    ssize_t write(int* saveErrno);
 
-    void Close(); // 关闭连接，关闭http响应的内存映射和关闭fd_
+    // 关闭连接，这次调用真正关闭了fd_返回true。有子线程正在处理这个连接时只shutdown，
+    // fd_、发送队列和它持有的文件留到EndTask里关闭和释放，任务结束前fd号不会被新连接复用
+    bool Close();
+
+    // 主线程把读写任务交给线程池之前调用BeginTask，子线程做完任务后调用EndTask，
+    // 任务期间连接被关闭了的话EndTask真正关闭fd_，返回true
+    void BeginTask() { busy_ = true; }
+    bool EndTask();
 
     int GetFd() const; // 获取fd_
 
-    int GetPort() const; // 获取端口号
+    int GetPort() const; // 获取端口号，主机字节序
 
-    const char* GetIP() const; // 获取ip地址,字符串类型的
+    const char* GetIP() const; // 获取ip地址,字符串类型的，第一次用到时才格式化
     
-    sockaddr_in GetAddr() const; // 获取addr_
+    const PeerAddr& GetPeer() const { return peer_; } // 对端的二进制地址
     
+    // 解析缓冲区里的请求，生成的响应放进发送队列，有响应要写返回true
+    // 流水线上的多个请求一次处理完，响应在队列里排好一起写
     bool process();
     // 需要写的字节数
-    int ToWriteBytes() { 
-        return iov_[0].iov_len + iov_[1].iov_len; 
+    size_t ToWriteBytes() const { 
+        return queue_.Bytes(); 
     }
 
+    // 以发出去的响应为准，解析出错时响应里已经告诉对方要关闭了
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        return response_.IsKeepAlive() && !isDraining;
     }
 
+    bool IsClosed() const { return isClose_; }
+
     static bool isET;                   // 是否是ET模式
+    static std::atomic<bool> isDraining; // 服务器正在排空，响应完当前请求就关闭
     static const char* srcDir;          // 资源的目录
     static std::atomic<int> userCount;  // 总共的客户端的连接数
+    static int bufferSize;              // 读写缓冲区的初始大小
+    static int bufferMax;               // 读缓冲区的上限，请求超过它就关闭连接
+    static bool msgMore;                // 响应头后面跟着文件时用MSG_MORE发响应头
+    static bool tcpCork;                // 写响应期间打开TCP_CORK，写完再关掉，凑满包再发
+
+    // /__stats和/__trace这类管理路径谁能访问，不允许时当成普通的文件路径，回404
+    enum ADMIN_ACCESS {
+        ADMIN_OFF,      // 谁都不能访问
+        ADMIN_LOCAL,    // 只有本机回环地址上来的连接
+        ADMIN_ALL,      // 所有连接
+    };
+    static ADMIN_ACCESS adminAccess;
     
 private:
    
     int fd_;  // 客户端的文件描述符
-    struct  sockaddr_in addr_;  // 客户端ip地址和端口号
+    PeerAddr peer_;  // 客户端ip地址和端口号
 
-    bool isClose_;  // 是否关闭
-    
-    int iovCnt_;   // 表示iov_[2]中有几个缓冲区是有东西的
-    struct iovec iov_[2]; // 两个缓冲区用于writev集中写
+    std::atomic<bool> isClose_;  // 是否关闭，主线程的定时器和子线程都可能关闭连接
+    std::atomic<bool> busy_;     // 有子线程正在处理这个连接的读写任务
+    std::atomic<bool> finished_; // fd_已经关闭、发送队列已经释放，Close和EndTask都可能去做，只做一次
     
     Buffer readBuff_; // 读（请求）缓冲区，保存请求数据的内容
-    Buffer writeBuff_; // 写（响应）缓冲区，保存响应数据的内容
+    Buffer writeBuff_; // 写（响应）缓冲区，保存响应头和内存里生成的响应
+    WriteQueue queue_; // 发送队列，writeBuff_的片段和文件段按响应的顺序排在里面
 
+    Arena arena_;          // 请求解析出来的数据都放在这里，每个请求结束后统一释放
     HttpRequest request_;  // 处理http请求
     HttpResponse response_; // 处理http响应
+
+    uint64_t acceptUs_;     // accept的时间，单位微秒
+    uint64_t reqStartUs_;   // 当前请求开始读的时间，0表示还没有请求
+    bool firstByteSent_;    // 是否已经写出过响应的第一个字节
+
+    // 等响应写完再记访问日志，流水线上可能有好几个，字符串的容量留着复用
+    struct Pending {
+        std::string method;
+        std::string path;
+        std::string version;
+        int status;
+        uint64_t bytes;
+        uint64_t startUs;
+        int reuse;
+    };
+    void AddPending_(uint64_t bytes);   // 当前的请求和响应要记访问日志
+    void FlushPending_();               // 响应写完了，写访问日志
+    bool AdminAllowed_() const;         // 这个连接能不能访问管理路径
+    bool Finish_();                     // 没有任务在跑时关闭fd_，释放发送队列和响应打开的文件
+
+    std::vector<Pending> pending_;
+    size_t pendingCnt_;     // pending_里前pendingCnt_个有效
+    int reuse_;             // 这个连接上已经处理了多少个请求
+
+    size_t readHint_;       // 这个连接一次读到的字节数，平滑过的
+    static const size_t MIN_READ_HINT = 512;
+    static const int SHRINK_RATIO = 4;  // 缓冲区超过初始大小的这么多倍时，请求结束后缩回去
+    static const int MAX_PIPELINE = 16; // 一次最多处理这么多个流水线请求，剩下的等这批写完
 };
 
 
@@ -4,144 +4,229 @@
  * @copyleft Apache 2.0
  */ 
 #include "httprequest.h"
+#include "consttable.h"
+#include <mutex>
+#include <unordered_map>
 using namespace std;
 
-const unordered_set<string> HttpRequest::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
+namespace {
 
-const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  };
+mutex g_memUserMtx;
+unordered_map<string, string> g_memUsers = { { "bench", "bench" } };
+
+} // namespace
+
+// 按字典序排列，ParsePath_里二分查找
+constexpr HttpRequest::DefaultHtml HttpRequest::DEFAULT_HTML[] = {
+            {"/index"}, {"/login"}, {"/picture"},
+            {"/register"}, {"/video"}, {"/welcome"}, };
+
+constexpr HttpRequest::HtmlTag HttpRequest::DEFAULT_HTML_TAG[] = {
+            {"/login.html", 1}, {"/register.html", 0}, };
+
+HttpRequest::Verifier HttpRequest::verifier_ = HttpRequest::UserVerify;
 
 void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";
+    method_ = path_ = query_ = version_ = body_ = string_view();
+    contentLength_ = 0;
     state_ = REQUEST_LINE;
-    header_.clear();
+    headers_.Clear();
     post_.clear();
+    arena_->Reset();
 }
 
 bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+    return version_ == "1.1" &&
+           HeaderMap::EqualsIgnoreCase(headers_.Get(HeaderMap::CONNECTION), "keep-alive");
+}
+
+// 查找post提交的表单数据对应键值的value
+string_view HttpRequest::GetPost(string_view key) const {
+    assert(!key.empty());
+    for(auto& field: post_) {
+        if(field.first == key) { return field.second; }
     }
-    return false;
+    return string_view();
 }
 
 // 用有限状态机解析读（请求）缓冲区的数据
-bool HttpRequest::parse(Buffer& buff) {
-    const char CRLF[] = "\r\n";  // 判断结束的标识符
-    if(buff.ReadableBytes() <= 0) {
-        return false;
-    }
-    while(buff.ReadableBytes() && state_ != FINISH) {
-        // 获取一行数据，根据\r\n为结束标志，就是在还未读的地方开始，然后到写完的地方，查找\r\n这个标志
-        const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        std::string line(buff.Peek(), lineEnd); // 获取读到的一行数据
-        switch(state_)
-        {
-        case REQUEST_LINE:
-            // 解析请求行
-            if(!ParseRequestLine_(line)) {
-                return false;
-            }
-            // 成功了就会解析请求地址
-            ParsePath_();
-            break;    
-        case HEADERS:
-            // 解析请求头
-            ParseHeader_(line);
-            // 表示没有请求体了，可以直接结束
-            if(buff.ReadableBytes() <= 2) {
+// 一次只解析一个请求，数据不完整时保留状态，下次读到更多数据后接着解析，流水线上后面的请求留在缓冲区里
+HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
+    // 上一个请求已经处理完了，开始解析新的请求
+    if(state_ == FINISH) { Init(); }
+    while(state_ != FINISH) {
+        if(state_ == BODY) {
+            // 请求体按Content-Length取，不按行
+            if(buff.ReadableBytes() < contentLength_) { return NO_REQUEST; }
+            ParseBody_(string_view(buff.Peek(), contentLength_));
+            buff.Retrieve(contentLength_);
+            break;
+        }
+        // 获取一行数据，以\n为结束标志，前面的\r去掉
+        const char* begin = buff.Peek();
+        const char* lineEnd = static_cast<const char*>(memchr(begin, '\n', buff.ReadableBytes()));
+        if(!lineEnd) {
+            // 一行还没有收全，太长的直接当成错误，避免缓冲区无限增长；
+            // 多留一个字节给还没收到\n的\r，否则刚好MAX_LINE长的行会因为分包的位置不同而时对时错
+            if(buff.ReadableBytes() > MAX_LINE + 1) {
+                LOG_WARN("Request line too long");
                 state_ = FINISH;
+                return BAD_REQUEST;
             }
-            break;
-        case BODY:
-            // 解析请求体
-            ParseBody_(line);
-            break;
-        default:
-            break;
+            return NO_REQUEST;
+        }
+        string_view line(begin, lineEnd - begin);
+        if(!line.empty() && line.back() == '\r') { line.remove_suffix(1); }
+        bool ok = true;
+        if(line.size() > MAX_LINE) {
+            LOG_WARN("Request line too long");
+            ok = false;
+        }
+        else if(state_ == REQUEST_LINE) {
+            // 请求行前面的空行忽略掉，有的客户端会在请求体后面多发一个\r\n
+            if(!line.empty()) { ok = ParseRequestLine_(line); }
+        }
+        else {
+            ok = ParseHeader_(line);
+        }
+        // 将读指针readPos_往后移动，移动到\n后面那个位置
+        buff.RetrieveUntil(lineEnd + 1);
+        if(!ok) {
+            state_ = FINISH;
+            return BAD_REQUEST;
         }
-        // 行的末尾和开始写的指针一样的时候就表示已经读完了
-        if(lineEnd == buff.BeginWrite()) { break; }
-        // 将读指针readPos_往后移动，移动到\r\n后面那个位置
-        buff.RetrieveUntil(lineEnd + 2);
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
-    return true;
+    LOG_DEBUG("[%.*s], [%.*s], [%.*s]", (int)method_.size(), method_.data(),
+                (int)path_.size(), path_.data(), (int)version_.size(), version_.data());
+    return GET_REQUEST;
 }
 
 // 解析请求路径
 void HttpRequest::ParsePath_() {
+    static_assert(IsSortedTable(DEFAULT_HTML), "DEFAULT_HTML must be sorted");
     if(path_ == "/") {
         path_ = "/index.html"; 
     }
-    else {
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
-                break;
-            }
-        }
+    else if(FindInTable(DEFAULT_HTML, path_)) {
+        path_ = arena_->Concat(path_, ".html");
     }
 }
 
-// 用正则表达式解析请求首行
-bool HttpRequest::ParseRequestLine_(const string& line) {
-    // GET / HTTP/1.1
-    // 一个()表示要匹配的一个东西
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {   
-        method_ = subMatch[1]; // 请求方法:get,post等
-        path_ = subMatch[2]; // url
-        version_ = subMatch[3]; // 请求版本HTTP/1.1
-        state_ = HEADERS;
-        return true;
+// 解析请求首行，GET / HTTP/1.1
+bool HttpRequest::ParseRequestLine_(string_view line) {
+    size_t sp1 = line.find(' ');
+    size_t sp2 = sp1 == string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+    if(sp2 == string_view::npos || line.compare(sp2 + 1, 5, "HTTP/") != 0 ||
+       line.find(' ', sp2 + 1) != string_view::npos) {
+        LOG_ERROR("RequestLine Error");
+        return false;
+    }
+    // 整行拷贝一次，各个字段指向这份拷贝
+    line = arena_->Copy(line);
+    method_ = line.substr(0, sp1);          // 请求方法:get,post等
+    string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);    // url
+    version_ = line.substr(sp2 + 6);        // 请求版本HTTP/1.1
+    size_t mark = target.find('?');
+    if(mark != string_view::npos) {
+        query_ = target.substr(mark + 1);
+        target = target.substr(0, mark);
+    }
+    // 拷贝在arena里，可以原地解码，同一个文件不管怎么编码都得到同一个路径
+    char* path = const_cast<char*>(target.data());
+    size_t pathLen = 0;
+    if(!UrlCodec::NormalizePath(path, target.size(), &pathLen)) {
+        LOG_WARN("Bad path: %.*s", (int)target.size(), target.data());
+        return false;
     }
-    LOG_ERROR("RequestLine Error");
-    return false;
+    path_ = string_view(path, pathLen);
+    state_ = HEADERS;
+    // 成功了就会解析请求地址
+    ParsePath_();
+    return true;
 }
-// 用正则表达式解析请求头
-void HttpRequest::ParseHeader_(const string& line) {
-    regex patten("^([^:]*): ?(.*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {
-        header_[subMatch[1]] = subMatch[2];
+
+// 解析请求头，Name: value
+bool HttpRequest::ParseHeader_(string_view line) {
+    if(line.empty()) { return HeadersDone_(); }
+    size_t colon = line.find(':');
+    if(colon == string_view::npos || colon == 0) {
+        LOG_ERROR("Header Error");
+        return false;
     }
-    else {
-        state_ = BODY;
+    if(headers_.Size() >= MAX_HEADERS) {
+        LOG_WARN("Too many headers");
+        return false;
+    }
+    line = arena_->Copy(line);
+    string_view name = line.substr(0, colon);
+    string_view value = line.substr(colon + 1);
+    size_t begin = value.find_first_not_of(" \t");
+    size_t end = value.find_last_not_of(" \t");
+    value = begin == string_view::npos ? value.substr(value.size()) : value.substr(begin, end - begin + 1);
+    // 重复的Content-Length/Transfer-Encoding可能被用来夹带请求，直接拒绝
+    HeaderMap::KNOWN id = HeaderMap::Classify(name);
+    if((id == HeaderMap::CONTENT_LENGTH || id == HeaderMap::TRANSFER_ENCODING) && headers_.Has(id)) {
+        LOG_WARN("Duplicate %.*s", (int)name.size(), name.data());
+        return false;
     }
+    headers_.Add(name, value);
+    return true;
+}
+
+// 请求头结束了，有Content-Length就接着读请求体
+bool HttpRequest::HeadersDone_() {
+    if(headers_.Has(HeaderMap::TRANSFER_ENCODING)) {
+        LOG_WARN("Transfer-Encoding is not supported");
+        return false;
+    }
+    string_view len = headers_.Get(HeaderMap::CONTENT_LENGTH);
+    // 有这个头但是值是空的，和重复的Content-Length一样不知道请求体多长，直接拒绝
+    if(headers_.Has(HeaderMap::CONTENT_LENGTH) && len.empty()) {
+        LOG_WARN("Empty Content-Length");
+        return false;
+    }
+    contentLength_ = 0;
+    for(char ch: len) {
+        if(ch < '0' || ch > '9' || contentLength_ > MAX_BODY) {
+            LOG_WARN("Bad Content-Length");
+            return false;
+        }
+        contentLength_ = contentLength_ * 10 + (ch - '0');
+    }
+    if(contentLength_ > MAX_BODY) {
+        LOG_WARN("Body too large: %zu", contentLength_);
+        return false;
+    }
+    state_ = contentLength_ > 0 ? BODY : FINISH;
+    return true;
 }
 
 // 解析请求体
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
+void HttpRequest::ParseBody_(string_view body) {
+    body_ = arena_->Copy(body);
     // 处理Post请求
     ParsePost_();
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body:%.*s, len:%zu", (int)body_.size(), body_.data(), body_.size());
 }
 
-int HttpRequest::ConverHex(char ch) {
-    if(ch >= 'A' && ch <= 'F') return ch -'A' + 10;
-    if(ch >= 'a' && ch <= 'f') return ch -'a' + 10;
-    return ch;
-}
 // 处理Post请求
 void HttpRequest::ParsePost_() {
     // 查看是否是表单提交的，如果是的话，就会是"application/x-www-form-urlencoded"类型
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+    if(method_ == "POST" && HeaderMap::EqualsIgnoreCase(headers_.Get(HeaderMap::CONTENT_TYPE),
+                                                    "application/x-www-form-urlencoded")) {
         //解析表单信息
         ParseFromUrlencoded_();
-        if(DEFAULT_HTML_TAG.count(path_)) {
+        static_assert(IsSortedTable(DEFAULT_HTML_TAG), "DEFAULT_HTML_TAG must be sorted");
+        const HtmlTag* item = FindInTable(DEFAULT_HTML_TAG, path_);
+        if(item) {
             // 根据url中是register还是login来判断是登录还是注册
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
+            int tag = item->tag;
             LOG_DEBUG("Tag:%d", tag);
             if(tag == 0 || tag == 1) {
                 bool isLogin = (tag == 1);
                 // 验证用户
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
+                if(verifier_(GetPost("username"), GetPost("password"), isLogin)) {
                     path_ = "/welcome.html";
                 } 
                 else {
@@ -151,56 +236,46 @@ void HttpRequest::ParsePost_() {
         }
     }   
 }
-// 解析表单数据
+// 解析表单数据，username=hello&password=hello，键值原地解码后指向body_
 void HttpRequest::ParseFromUrlencoded_() {
-    if(body_.size() == 0) { return; }
+    // body_是拷贝在arena里的，可以原地修改
+    char* body = const_cast<char*>(body_.data());
+    size_t n = body_.size();
+    size_t i = 0;
+    while(i < n) {
+        char* pair = body + i;
+        const char* amp = static_cast<const char*>(memchr(pair, '&', n - i));
+        size_t pairLen = amp ? amp - pair : n - i;
+        i += pairLen + 1;
 
-    string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
-
-    // username=hello&password=hello
-    for(; i < n; i++) {
-        char ch = body_[i];
-        switch (ch) {
-        case '=':
-            key = body_.substr(j, i - j);
-            j = i + 1;
-            break;
-        case '+':
-            body_[i] = ' ';
-            break;
-        case '%':
-            // 输入中文的时候就会出现
-            // 简单的加密的操作，编码
-            num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-            body_[i + 2] = num % 10 + '0';
-            body_[i + 1] = num / 10 + '0';
-            i += 2;
-            break;
-        case '&':
-            value = body_.substr(j, i - j);
-            j = i + 1;
-            post_[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
-            break;
-        default:
-            break;
-        }
-    }
-    assert(j <= i);
-    // 最后一对表单数据
-    if(post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+        const char* eq = static_cast<const char*>(memchr(pair, '=', pairLen));
+        if(!eq || eq == pair) { continue; }
+        size_t keyLen = UrlCodec::Decode(pair, eq - pair, true);
+        char* value = pair + (eq - pair) + 1;
+        size_t valueLen = UrlCodec::Decode(value, pair + pairLen - value, true);
+        string_view key(pair, keyLen);
+        // 同名的以第一个为准
+        if(GetPost(key).data()) { continue; }
+        post_.emplace_back(key, string_view(value, valueLen));
+        LOG_DEBUG("%.*s = %.*s", (int)keyLen, pair, (int)valueLen, value);
     }
 }
 
 // 用户验证
-bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
-    if(name == "" || pwd == "") { return false; }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+// 和UserVerify的规则一样：登录要用户存在且密码对，注册要用户名没被占用
+bool HttpRequest::MemoryVerify(string_view name, string_view pwd, bool isLogin) {
+    if(name.empty() || pwd.empty()) { return false; }
+    lock_guard<mutex> locker(g_memUserMtx);
+    auto it = g_memUsers.find(string(name));
+    if(isLogin) { return it != g_memUsers.end() && it->second == pwd; }
+    if(it != g_memUsers.end()) { return false; }
+    g_memUsers.emplace(name, pwd);
+    return true;
+}
+
+bool HttpRequest::UserVerify(string_view name, string_view pwd, bool isLogin) {
+    if(name.empty() || pwd.empty()) { return false; }
+    LOG_INFO("Verify name:%.*s pwd:%.*s", (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
     MYSQL* sql;
     // 从连接池中获取一个连接
     SqlConnRAII(&sql,  SqlConnPool::Instance());
@@ -216,7 +291,8 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     if(!isLogin) { flag = true; }
     /* 查询用户及密码 */
     // 拼接一下sql语句
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
+    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%.*s' LIMIT 1",
+                (int)name.size(), name.data());
     LOG_DEBUG("%s", order);
     // 执行sql语句，成功返回0，继续往下走，不成功返回非0直接释放res返回
     if(mysql_query(sql, order)) { 
@@ -234,10 +310,9 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     // 从结果集合中取得下一行
     while(MYSQL_ROW row = mysql_fetch_row(res)) {
         LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
         /* 登录行为*/
         if(isLogin) {
-            if(pwd == password) { flag = true; }
+            if(pwd == row[1]) { flag = true; }
             else {
                 flag = false;
                 LOG_DEBUG("pwd error!");
@@ -255,7 +330,8 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     if(!isLogin && flag == true) {
         LOG_DEBUG("regirster!");
         bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
+        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%.*s','%.*s')",
+                    (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
         LOG_DEBUG( "%s", order);
         if(mysql_query(sql, order)) { 
             LOG_DEBUG( "Insert error!");
@@ -268,35 +344,3 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     LOG_DEBUG( "UserVerify success!!");
     return flag;
 }
-// 获取请求路径
-std::string HttpRequest::path() const{
-    return path_;
-}
-// 获取请求路径
-std::string& HttpRequest::path(){
-    return path_;
-}
-// 获取请求方法
-std::string HttpRequest::method() const {
-    return method_;
-}
-// 获取请求版本
-std::string HttpRequest::version() const {
-    return version_;
-}
-// 查找post提交的表单数据对应键值的value
-std::string HttpRequest::GetPost(const std::string& key) const {
-    assert(key != "");
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
-}
-// 查找post提交的表单数据对应键值的value
-std::string HttpRequest::GetPost(const char* key) const {
-    assert(key != nullptr);
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
-}
\ No newline at end of file
@@ -6,14 +6,17 @@
 #ifndef HTTP_REQUEST_H
 #define HTTP_REQUEST_H
 
-#include <unordered_map>
-#include <unordered_set>
 #include <string>
-#include <regex>
+#include <string_view>
+#include <vector>
+#include <utility>
 #include <errno.h>     
 #include <mysql/mysql.h>  //mysql
 
 #include "../buffer/buffer.h"
+#include "../buffer/arena.h"
+#include "headermap.h"
+#include "urlcodec.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/sqlconnRAII.h"
@@ -38,48 +41,75 @@ public:
         CLOSED_CONNECTION,  // 连接关闭
     };
     
-    HttpRequest() { Init(); } 
+    // 解析出来的字段都拷贝在arena里，arena由连接持有，一个请求处理完以后统一释放
+    explicit HttpRequest(Arena* arena): arena_(arena) { Init(); }
     ~HttpRequest() = default; 
 
-    void Init(); // 初始化http请求
-    bool parse(Buffer& buff);  // 用有限状态机解析读（请求）缓冲区的数据
-    // 获取请求路径，请求方法，请求协议版本
-    std::string path() const;
-    std::string& path();
-    std::string method() const;
-    std::string version() const;
+    void Init(); // 初始化http请求，释放上一个请求在arena里的数据
+    // 用有限状态机解析读（请求）缓冲区的数据，可以分多次调用，数据不够时返回NO_REQUEST，
+    // 解析完一个请求返回GET_REQUEST，出错返回BAD_REQUEST，缓冲区里只取走这一个请求的数据
+    HTTP_CODE parse(Buffer& buff);
+    // 获取请求路径，请求方法，请求协议版本，都指向arena，下一个请求开始解析后失效
+    std::string_view path() const { return path_; }
+    std::string_view method() const { return method_; }
+    std::string_view version() const { return version_; }
+    std::string_view query() const { return query_; }  // ?后面的部分，没有解码
+    std::string_view body() const { return body_; }    // 表单请求的请求体被原地解码过，用GetPost取
 
-    // 查找post提交的表单数据对应键值的value
-    std::string GetPost(const std::string& key) const;
-    std::string GetPost(const char* key) const;
+    typedef std::pair<std::string_view, std::string_view> Field;
+
+    // 查找请求头和post提交的表单数据对应键值的value，没有时返回空
+    std::string_view GetHeader(std::string_view key) const { return headers_.Get(key); }
+    std::string_view GetPost(std::string_view key) const;
+    const HeaderMap& Headers() const { return headers_; }
+    const std::vector<Field>& Post() const { return post_; }
 
     // 是否保持KeepAlive
     bool IsKeepAlive() const;
 
+    // 验证登录/注册的函数，默认查数据库，fuzz测试里换成不访问数据库的
+    typedef bool (*Verifier)(std::string_view name, std::string_view pwd, bool isLogin);
+    static void SetVerifier(Verifier verifier) { verifier_ = verifier; }
+    // 代替数据库的内存用户表，压测登录时用，预先有bench/bench这个用户，注册的用户只在内存里
+    static bool MemoryVerify(std::string_view name, std::string_view pwd, bool isLogin);
+
+    static const size_t MAX_LINE = 8192;            // 请求行和单个请求头的最大长度
+    static const size_t MAX_BODY = 1024 * 1024;     // 请求体的最大长度
+    static const size_t MAX_HEADERS = 100;          // 请求头的最大个数
+
 private:
-    // 用正则表达式解析请求首行
-    bool ParseRequestLine_(const std::string& line);
-    // 用正则表达式解析请求头
-    void ParseHeader_(const std::string& line);
+    // 解析请求首行
+    bool ParseRequestLine_(std::string_view line);
+    // 解析请求头，空行表示请求头结束
+    bool ParseHeader_(std::string_view line);
+    // 请求头结束以后根据Content-Length决定要不要读请求体
+    bool HeadersDone_();
     // 解析请求体
-    void ParseBody_(const std::string& line);
+    void ParseBody_(std::string_view body);
     // 解析请求路径
     void ParsePath_();
     // 解析post请求
     void ParsePost_();
-    // 解析表单数据(根据实际要详细再看看)
+    // 解析表单数据，原地解码，键值都指向body_
     void ParseFromUrlencoded_();
     // 验证用户登录
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
+    static bool UserVerify(std::string_view name, std::string_view pwd, bool isLogin);
 
+    static Verifier verifier_;
+
+    Arena* arena_;
     PARSE_STATE state_;        //解析的状态
-    std::string method_, path_, version_, body_;    // 请求方法，请求路径，协议版本，请求体
-    std::unordered_map<std::string, std::string> header_;   // 请求头，键值和对应的数据为一组请求头
-    std::unordered_map<std::string, std::string> post_;         // post请求表单数据
+    std::string_view method_, path_, query_, version_, body_;    // 请求方法，请求路径(已解码、规范化)，查询串，协议版本，请求体
+    size_t contentLength_;      // 请求体的长度
+    HeaderMap headers_;         // 请求头
+    std::vector<Field> post_;   // post请求表单数据
+
+    // 编译期有序表，见consttable.h
+    struct DefaultHtml { std::string_view key; };
+    struct HtmlTag { std::string_view key; int tag; };
 
-    static const std::unordered_set<std::string> DEFAULT_HTML;      // 默认的网页
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG; 
-    static int ConverHex(char ch);   // 转换成十六进制
+    static const DefaultHtml DEFAULT_HTML[];    // 默认的网页
+    static const HtmlTag DEFAULT_HTML_TAG[];    // 需要验证用户的网页 - 0注册/1登录
 };
 
 
@@ -4,39 +4,54 @@
  * @copyleft Apache 2.0
  */ 
 #include "httpresponse.h"
+#include "consttable.h"
 
 using namespace std;
 
-const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
-    { ".html",  "text/html" },
-    { ".xml",   "text/xml" },
-    { ".xhtml", "application/xhtml+xml" },
-    { ".txt",   "text/plain" },
-    { ".rtf",   "application/rtf" },
-    { ".pdf",   "application/pdf" },
-    { ".word",  "application/nsword" },
-    { ".png",   "image/png" },
+// 按后缀字典序排列，新增类型时要保持有序，否则GetFileType_里的static_assert编译不过
+constexpr HttpResponse::SuffixType HttpResponse::SUFFIX_TYPE[] = {
+    { ".au",    "audio/basic" },
+    { ".avi",   "video/x-msvideo" },
+    { ".css",   "text/css" },
+    { ".eot",   "application/vnd.ms-fontobject" },
     { ".gif",   "image/gif" },
-    { ".jpg",   "image/jpeg" },
+    { ".gz",    "application/x-gzip" },
+    { ".htm",   "text/html" },
+    { ".html",  "text/html" },
+    { ".ico",   "image/x-icon" },
     { ".jpeg",  "image/jpeg" },
-    { ".au",    "audio/basic" },
+    { ".jpg",   "image/jpeg" },
+    { ".js",    "text/javascript" },
+    { ".json",  "application/json" },
+    { ".mp4",   "video/mp4" },
     { ".mpeg",  "video/mpeg" },
     { ".mpg",   "video/mpeg" },
-    { ".avi",   "video/x-msvideo" },
-    { ".gz",    "application/x-gzip" },
+    { ".otf",   "font/otf" },
+    { ".pdf",   "application/pdf" },
+    { ".png",   "image/png" },
+    { ".rtf",   "application/rtf" },
+    { ".svg",   "image/svg+xml" },
     { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
+    { ".ttf",   "font/ttf" },
+    { ".txt",   "text/plain" },
+    { ".webp",  "image/webp" },
+    { ".woff",  "font/woff" },
+    { ".woff2", "font/woff2" },
+    { ".word",  "application/msword" },
+    { ".xhtml", "application/xhtml+xml" },
+    { ".xml",   "text/xml" },
 };
+
 // 响应状态码
-const unordered_map<int, string> HttpResponse::CODE_STATUS = {
+constexpr HttpResponse::CodeStatus HttpResponse::CODE_STATUS[] = {
     { 200, "OK" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
 };
+
 // 错误情况的返回资源路径
-const unordered_map<int, string> HttpResponse::CODE_PATH = {
+constexpr HttpResponse::CodePath HttpResponse::CODE_PATH[] = {
     { 400, "/400.html" },
     { 403, "/403.html" },
     { 404, "/404.html" },
@@ -46,33 +61,42 @@ HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
+    fileStat_ = { 0 };
+    preloaded_ = nullptr;
 };
 
 HttpResponse::~HttpResponse() {
-    UnmapFile();
+    CloseFile();
 }
 // 初始化资源的路径，资源的目录，是否长连接，响应状态码，内存映射相关
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
-    assert(srcDir != "");
-    if(mmFile_) { UnmapFile(); }
+void HttpResponse::Init(string_view srcDir, string_view path, bool isKeepAlive, int code){
+    assert(!srcDir.empty());
+    CloseFile();
     code_ = code;
     isKeepAlive_ = isKeepAlive;
     path_ = path;
     srcDir_ = srcDir;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
+    fileStat_ = { 0 };
 }
 // 把http响应信息封装进writeBuff_中
 void HttpResponse::MakeResponse(Buffer& buff) {
     /* 判断请求的资源文件 */
     // index.html
     // /home/gdw/WebServer-master/resources/index.html
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    if(code_ >= 400) {
+        // 请求解析出错时路径不可信，直接用错误页
+    }
+    else if(FindPreloaded_()) {
+        // 响应头是建镜像时生成好的
+        code_ = 200;
+        string_view head = isKeepAlive_ ? preloaded_->keepAliveHead : preloaded_->closeHead;
+        buff.Append(head.data(), head.size());
+        return;
+    }
+    else if(!FindFile_() || S_ISDIR(fileStat_.st_mode)) {
         code_ = 404;
     }
-    else if(!(mmFileStat_.st_mode & S_IROTH)) {
+    else if(!(fileStat_.st_mode & S_IROTH)) {
         code_ = 403;
     }
     else if(code_ == -1) { 
@@ -82,38 +106,81 @@ void HttpResponse::MakeResponse(Buffer& buff) {
     ErrorHtml_();
     // 添加响应首行
     AddStateLine_(buff);
-    AddHeader_(buff);
+    AddHeader_(buff, GetFileType_());
     AddContent_(buff);
 }
-// 返回文件指针
-char* HttpResponse::File() {
-    return mmFile_;
+// 直接用内存里的body作为响应
+void HttpResponse::MakeResponse(Buffer& buff, std::string_view contentType, std::string_view body) {
+    if(code_ == -1) {
+        code_ = 200;
+    }
+    AddStateLine_(buff);
+    AddHeader_(buff, contentType);
+    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+    buff.Append(body.data(), body.size());
+}
+// 把文件作为一个sendfile段入队，之后文件由队列持有，发完就关闭
+void HttpResponse::QueueFile(WriteQueue& queue) {
+    if(preloaded_) {
+        string_view body = preloaded_->body;
+        preloaded_ = nullptr;
+        queue.AppendMemory(body.data(), body.size(), std::move(image_));
+    }
+    else if(file_) {
+        int fd = file_->fd;
+        queue.AppendFile(fd, 0, fileStat_.st_size, std::move(file_));
+    }
 }
 // 返回文件长度
 size_t HttpResponse::FileLen() const {
-    return mmFileStat_.st_size;
+    if(preloaded_) { return preloaded_->body.size(); }
+    return file_ ? fileStat_.st_size : 0;
+}
+// 只生成响应头，内容的长度由调用者给出
+void HttpResponse::MakeHeader(Buffer& buff, size_t contentLen) {
+    if(code_ == -1) {
+        code_ = 200;
+    }
+    AddStateLine_(buff);
+    AddHeader_(buff, GetFileType_());
+    buff.Append("Content-length: " + to_string(contentLen) + "\r\n\r\n");
 }
 // 看看有没有错误码
 void HttpResponse::ErrorHtml_() {
-    if(CODE_PATH.count(code_) == 1) {
-        path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+    static_assert(IsSortedTable(CODE_PATH), "CODE_PATH must be sorted");
+    const CodePath* item = FindInTable(CODE_PATH, code_);
+    if(item) {
+        path_ = std::string(item->path);
+        FindFile_();
     }
 }
+// 从文件缓存里找文件，命中时不用stat和open
+bool HttpResponse::FindFile_() {
+    return FileCache::Instance()->Lookup(srcDir_ + path_, &file_, &fileStat_);
+}
+// 镜像是用同一个资源目录建的，只比较请求路径
+bool HttpResponse::FindPreloaded_() {
+    const shared_ptr<const StaticImage>& image = StaticImage::Current();
+    if(!image) { return false; }
+    preloaded_ = image->Find(path_);
+    if(!preloaded_) { return false; }
+    image_ = image;
+    return true;
+}
 // 添加响应首行
 void HttpResponse::AddStateLine_(Buffer& buff) {
-    string status;
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
-    }
-    else {
+    static_assert(IsSortedTable(CODE_STATUS), "CODE_STATUS must be sorted");
+    const CodeStatus* item = FindInTable(CODE_STATUS, code_);
+    if(!item) {
         code_ = 400;
-        status = CODE_STATUS.find(400)->second;
+        item = FindInTable(CODE_STATUS, code_);
     }
-    buff.Append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+    buff.Append("HTTP/1.1 " + to_string(code_) + " ");
+    buff.Append(item->status.data(), item->status.size());
+    buff.Append("\r\n", 2);
 }
 // 添加响应头
-void HttpResponse::AddHeader_(Buffer& buff) {
+void HttpResponse::AddHeader_(Buffer& buff, std::string_view contentType) {
     buff.Append("Connection: ");
     if(isKeepAlive_) {
         buff.Append("keep-alive\r\n");
@@ -121,50 +188,43 @@ void HttpResponse::AddHeader_(Buffer& buff) {
     } else{
         buff.Append("close\r\n");
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    buff.Append("Content-type: ");
+    buff.Append(contentType.data(), contentType.size());
+    buff.Append("\r\n", 2);
 }
 
-// 添加文件映射，也是在添加响应头Content-length:字段
+// 添加响应头Content-length:字段，文件在FindFile_里已经打开了
+// 文件内容不读进用户态，由发送队列用sendfile直接从页缓存发出去
 void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-    if(srcFd < 0) { 
+    if(!file_) { 
         ErrorContent(buff, "File NotFound!");
         return; 
     }
-
-    /* 将文件映射到内存提高文件的访问速度 
-        MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
     LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
-        ErrorContent(buff, "File NotFound!");
-        return; 
-    }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
     //一个是回车，一个是响应空行
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    buff.Append("Content-length: " + to_string(fileStat_.st_size) + "\r\n\r\n");
 }
 
-// 解除内存映射
-void HttpResponse::UnmapFile() {
-    if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
-    }
+// 关闭还没有入队的文件
+void HttpResponse::CloseFile() {
+    file_.reset();
+    image_.reset();
+    preloaded_ = nullptr;
 }
 
 // 获取当前文件的类型
-string HttpResponse::GetFileType_() {
+std::string_view HttpResponse::GetFileType_() {
     /* 判断文件类型 */
     // 找到路径   .xxxx的内容，就是文件后缀名
-    string::size_type idx = path_.find_last_of('.');
-    if(idx == string::npos) {
+    static_assert(IsSortedTable(SUFFIX_TYPE), "SUFFIX_TYPE must be sorted");
+    std::string_view path(path_);
+    std::string_view::size_type idx = path.find_last_of('.');
+    if(idx == std::string_view::npos) {
         return "text/plain";
     }
-    string suffix = path_.substr(idx);
-    if(SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix)->second;
+    const SuffixType* item = FindInTable(SUFFIX_TYPE, path.substr(idx));
+    if(item) {
+        return item->type;
     }
     return "text/plain";
 }
@@ -172,15 +232,16 @@ string HttpResponse::GetFileType_() {
 void HttpResponse::ErrorContent(Buffer& buff, string message) 
 {
     string body;
-    string status;
+    std::string_view status = "Bad Request";
     body += "<html><title>Error</title>";
     body += "<body bgcolor=\"ffffff\">";
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
-    } else {
-        status = "Bad Request";
+    const CodeStatus* item = FindInTable(CODE_STATUS, code_);
+    if(item) {
+        status = item->status;
     }
-    body += to_string(code_) + " : " + status  + "\n";
+    body += to_string(code_) + " : ";
+    body += status;
+    body += "\n";
     body += "<p>" + message + "</p>";
     body += "<hr><em>TinyWebServer</em></body></html>";
 
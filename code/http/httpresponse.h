@@ -6,13 +6,17 @@
 #ifndef HTTP_RESPONSE_H
 #define HTTP_RESPONSE_H
 
-#include <unordered_map>
+#include <string>
+#include <string_view>
 #include <fcntl.h>       // open
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
-#include <sys/mman.h>    // mmap, munmap
+#include <memory>
 
 #include "../buffer/buffer.h"
+#include "../buffer/writequeue.h"
+#include "filecache.h"
+#include "staticimage.h"
 #include "../log/log.h"
 
 class HttpResponse {
@@ -20,21 +24,27 @@ public:
     HttpResponse(); // 初始化http响应信息
     ~HttpResponse(); 
     // 初始化资源的路径，资源的目录，是否长连接，响应状态码，内存映射相关
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    void Init(std::string_view srcDir, std::string_view path, bool isKeepAlive = false, int code = -1);
     void MakeResponse(Buffer& buff); //把http响应信息封装进writeBuff_中
-    void UnmapFile();  // 解除内存映射
-    char* File();   // 返回文件指针
+    // 不读文件，直接用内存里生成好的body作为响应，比如统计信息
+    void MakeResponse(Buffer& buff, std::string_view contentType, std::string_view body);
+    void QueueFile(WriteQueue& queue);  // 把要发送的文件作为一个sendfile段放进发送队列
+    void CloseFile();  // 关闭打开的文件，已经入队的段自己持有文件，不受影响
     size_t FileLen() const;  // 返回文件长度
+    void MakeHeader(Buffer& buff, size_t contentLen);  // 只生成响应头，预加载镜像用
     void ErrorContent(Buffer& buff, std::string message);
     int Code() const { return code_; } // 返回响应状态码
+    bool IsKeepAlive() const { return isKeepAlive_; } // 响应里是否告诉对方保持连接
 
 private:
     void AddStateLine_(Buffer &buff); // 添加响应首行
-    void AddHeader_(Buffer &buff);   // 添加响应头
-    void AddContent_(Buffer &buff);  // // 添加文件映射，也是在添加响应头Content-length:字段
+    void AddHeader_(Buffer &buff, std::string_view contentType);   // 添加响应头
+    void AddContent_(Buffer &buff);  // 添加响应头Content-length:字段
+    bool FindFile_();  // 查找资源文件，存在的话打开它并取得状态
+    bool FindPreloaded_();  // 在预加载镜像里找
 
     void ErrorHtml_();  // 看看有没有错误码，就有添加错误码的资源路径
-    std::string GetFileType_();  // 获取当前文件的类型
+    std::string_view GetFileType_();  // 获取当前文件的类型
 
     int code_;      // 响应状态码
     bool isKeepAlive_;  //  是否保持连接
@@ -42,12 +52,20 @@ private:
     std::string path_;    // 资源的路径
     std::string srcDir_;  // 资源的目录
     
-    char* mmFile_;   // 内存映射的文件
-    struct stat mmFileStat_;  // 文件的状态信息
+    std::shared_ptr<WriteQueue::FileRef> file_;   // 打开的文件，入队以后由发送队列持有
+    struct stat fileStat_;  // 文件的状态信息
 
-    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;  // 后缀 - 类型
-    static const std::unordered_map<int, std::string> CODE_STATUS;          //  状态码 - 描述
-    static const std::unordered_map<int, std::string> CODE_PATH;            // 状态米 - 路径
+    std::shared_ptr<const StaticImage> image_;      // 命中预加载镜像时持有它，入队以后由发送队列持有
+    const StaticImage::Entry* preloaded_;
+
+    // 编译期有序表，见consttable.h
+    struct SuffixType { std::string_view key; std::string_view type; };
+    struct CodeStatus { int key; std::string_view status; };
+    struct CodePath { int key; std::string_view path; };
+
+    static const SuffixType SUFFIX_TYPE[];  // 后缀 - 类型
+    static const CodeStatus CODE_STATUS[];  //  状态码 - 描述
+    static const CodePath CODE_PATH[];      // 状态米 - 路径
 };
 
 
@@ -0,0 +1,92 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-15
+ * @copyleft Apache 2.0
+ */
+#include "peeraddr.h"
+
+#include <string.h>
+#include <sched.h>      // sched_yield
+#include <endian.h>     // be64toh
+
+namespace {
+
+// ::ffff:a.b.c.d，双栈监听时IPv4客户端的地址长这样
+bool IsV4Mapped(const sockaddr_in6* addr) {
+    return IN6_IS_ADDR_V4MAPPED(&addr->sin6_addr);
+}
+
+} // namespace
+
+PeerAddr::PeerAddr(): state_(EMPTY) {
+    memset(&addr_, 0, sizeof(addr_));
+    ip_[0] = '\0';
+}
+
+void PeerAddr::Set(const sockaddr* addr, socklen_t len) {
+    memset(&addr_, 0, sizeof(addr_));
+    if(len > sizeof(addr_)) { len = sizeof(addr_); }
+    memcpy(&addr_, addr, len);
+    state_.store(EMPTY, std::memory_order_relaxed);
+}
+
+uint16_t PeerAddr::Port() const {
+    if(addr_.ss_family == AF_INET6) {
+        return ntohs(reinterpret_cast<const sockaddr_in6*>(&addr_)->sin6_port);
+    }
+    return ntohs(reinterpret_cast<const sockaddr_in*>(&addr_)->sin_port);
+}
+
+const char* PeerAddr::Ip() const {
+    int state = state_.load(std::memory_order_acquire);
+    if(state == READY) { return ip_; }
+    if(state == EMPTY && state_.compare_exchange_strong(state, FORMATTING, std::memory_order_acquire)) {
+        const char* ret = nullptr;
+        if(addr_.ss_family == AF_INET6) {
+            const sockaddr_in6* addr6 = reinterpret_cast<const sockaddr_in6*>(&addr_);
+            if(IsV4Mapped(addr6)) {
+                ret = inet_ntop(AF_INET, &addr6->sin6_addr.s6_addr[12], ip_, sizeof(ip_));
+            } else {
+                ret = inet_ntop(AF_INET6, &addr6->sin6_addr, ip_, sizeof(ip_));
+            }
+        } else if(addr_.ss_family == AF_INET) {
+            ret = inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(&addr_)->sin_addr, ip_, sizeof(ip_));
+        }
+        if(!ret) { strcpy(ip_, "?"); }
+        state_.store(READY, std::memory_order_release);
+        return ip_;
+    }
+    // 另一个线程正在格式化，很快就好
+    while(state_.load(std::memory_order_acquire) != READY) {
+        sched_yield();
+    }
+    return ip_;
+}
+
+bool PeerAddr::IsLoopback() const {
+    if(addr_.ss_family == AF_INET6) {
+        const sockaddr_in6* addr6 = reinterpret_cast<const sockaddr_in6*>(&addr_);
+        if(IsV4Mapped(addr6)) { return addr6->sin6_addr.s6_addr[12] == 127; }
+        return IN6_IS_ADDR_LOOPBACK(&addr6->sin6_addr);
+    }
+    if(addr_.ss_family == AF_INET) {
+        return (ntohl(reinterpret_cast<const sockaddr_in*>(&addr_)->sin_addr.s_addr) >> 24) == 127;
+    }
+    return false;
+}
+
+uint64_t PeerAddr::Key(const sockaddr* addr) {
+    if(addr->sa_family == AF_INET6) {
+        const sockaddr_in6* addr6 = reinterpret_cast<const sockaddr_in6*>(addr);
+        uint32_t v4;
+        if(IsV4Mapped(addr6)) {
+            memcpy(&v4, &addr6->sin6_addr.s6_addr[12], sizeof(v4));
+            return v4;
+        }
+        uint64_t prefix;
+        memcpy(&prefix, addr6->sin6_addr.s6_addr, sizeof(prefix));
+        // 按网络字节序转过来，前缀的高32位不是0(::/32是保留的)，不会和只有低32位的IPv4键撞上
+        return be64toh(prefix);
+    }
+    return reinterpret_cast<const sockaddr_in*>(addr)->sin_addr.s_addr;
+}
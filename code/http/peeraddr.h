@@ -0,0 +1,47 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-15
+ * @copyleft Apache 2.0
+ */
+#ifndef PEER_ADDR_H
+#define PEER_ADDR_H
+
+#include <atomic>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>   // INET6_ADDRSTRLEN
+
+// 连接对端的地址，accept拿到的二进制地址原样保存，支持IPv4和IPv6
+// 只有日志真的要打印时才格式化成字符串，缓存在连接自己身上，不用inet_ntoa的静态缓冲区，
+// 主线程的定时器和子线程同时要格式化时只有一个去做，另一个等它做完。
+// 原子状态只管这两个格式化的线程，不管Set：连接的fd关闭以后主线程可能马上复用它调用Set，
+// 所以Ip()、Port()、Key()都要在fd关闭之前用
+class PeerAddr {
+public:
+    PeerAddr();
+
+    PeerAddr(const PeerAddr&) = delete;
+    PeerAddr& operator=(const PeerAddr&) = delete;
+
+    // 换成新的地址，清掉格式化的缓存，连接初始化时调用，旧连接的fd已经关了，不能再有线程读旧地址
+    void Set(const sockaddr* addr, socklen_t len);
+
+    int Family() const { return addr_.ss_family; }
+    uint16_t Port() const;      // 主机字节序的端口
+    const char* Ip() const;     // 格式化好的ip，IPv4映射的IPv6地址按IPv4打印
+    bool IsLoopback() const;    // 127.0.0.0/8或者::1，IPv4映射的也算
+
+    // 单ip连接数限制用的键，IPv6按/64前缀计数，一个用户通常拿到整个/64
+    uint64_t Key() const { return Key(reinterpret_cast<const sockaddr*>(&addr_)); }
+    static uint64_t Key(const sockaddr* addr);
+
+private:
+    enum { EMPTY, FORMATTING, READY };
+
+    sockaddr_storage addr_;
+    mutable std::atomic<int> state_;            // ip_的状态
+    mutable char ip_[INET6_ADDRSTRLEN];
+};
+
+#endif //PEER_ADDR_H
@@ -0,0 +1,245 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-27
+ * @copyleft Apache 2.0
+ */
+#include "staticimage.h"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "httpresponse.h"
+#include "../log/log.h"
+
+using namespace std;
+
+namespace {
+
+struct File {
+    string rel;     // 相对资源目录的路径，以/开头，就是请求路径
+    size_t size;
+};
+
+// 递归找出所有其他人可读的非空普通文件，不进入链接到目录的符号链接
+void Walk(const string& root, const string& rel, vector<File>* files) {
+    DIR* dp = opendir((root + rel).c_str());
+    if(!dp) { return; }
+    while(dirent* ent = readdir(dp)) {
+        string name = ent->d_name;
+        if(name == "." || name == "..") { continue; }
+        string child = rel + "/" + name;
+        string path = root + child;
+        struct stat st;
+        if(lstat(path.c_str(), &st) < 0) { continue; }
+        if(S_ISDIR(st.st_mode)) {
+            Walk(root, child, files);
+            continue;
+        }
+        if(S_ISLNK(st.st_mode) && stat(path.c_str(), &st) < 0) { continue; }
+        if(S_ISREG(st.st_mode) && (st.st_mode & S_IROTH) && st.st_size > 0) {
+            files->push_back({ child, static_cast<size_t>(st.st_size) });
+        }
+    }
+    closedir(dp);
+}
+
+// 和HttpResponse生成的响应头一模一样
+string MakeHead(const string& srcDir, const string& rel, size_t len, bool keepAlive) {
+    HttpResponse response;
+    response.Init(srcDir, rel, keepAlive, 200);
+    Buffer buff(256);
+    response.MakeHeader(buff, len);
+    return buff.RetrieveAllToStr();
+}
+
+// 读整个文件，大小和扫描时不一样说明文件正在被改，不要了
+bool ReadFile(const string& path, char* dst, size_t size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return false; }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size;
+    size_t done = 0;
+    while(ok && done < size) {
+        ssize_t len = read(fd, dst + done, size - done);
+        if(len < 0 && errno == EINTR) { continue; }
+        if(len <= 0) { ok = false; }
+        else { done += len; }
+    }
+    close(fd);
+    return ok;
+}
+
+mutex g_currentMtx;
+shared_ptr<const StaticImage> g_current;
+atomic<uint64_t> g_currentGen{0};
+
+} // namespace
+
+StaticImage::~StaticImage() {
+    if(data_) { munmap(data_, size_); }
+}
+
+shared_ptr<const StaticImage> StaticImage::Build(const string& srcDir, const Options& options) {
+    vector<File> files;
+    Walk(srcDir, "", &files);
+    sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.rel < b.rel; });
+
+    // 先生成响应头，算出一共要多大
+    struct Item {
+        const File* file;
+        string keepAliveHead;
+        string closeHead;
+    };
+    vector<Item> items;
+    size_t total = 0;
+    for(auto& file: files) {
+        if(file.size > options.maxFileBytes) { continue; }
+        Item item = { &file, MakeHead(srcDir, file.rel, file.size, true), MakeHead(srcDir, file.rel, file.size, false) };
+        size_t need = file.rel.size() + item.closeHead.size() + item.keepAliveHead.size() + file.size;
+        if(total + need > options.maxBytes) { continue; }
+        total += need;
+        items.push_back(std::move(item));
+    }
+
+    shared_ptr<StaticImage> image(new StaticImage);
+    if(total == 0) { return image; }
+    void* mem = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) {
+        LOG_ERROR("mmap %zu bytes for static image error: %d", total, errno);
+        return nullptr;
+    }
+    image->data_ = static_cast<char*>(mem);
+    image->size_ = total;
+    image->index_.reserve(items.size());
+    // 每个文件依次放路径、短连接响应头、长连接响应头、内容，长连接的响应头和内容挨着
+    char* p = image->data_;
+    for(auto& item: items) {
+        const File& file = *item.file;
+        char* path = p;
+        char* closeHead = path + file.rel.size();
+        char* keepAliveHead = closeHead + item.closeHead.size();
+        char* body = keepAliveHead + item.keepAliveHead.size();
+        p = body + file.size;
+        if(!ReadFile(srcDir + file.rel, body, file.size)) { continue; }
+        memcpy(path, file.rel.data(), file.rel.size());
+        memcpy(closeHead, item.closeHead.data(), item.closeHead.size());
+        memcpy(keepAliveHead, item.keepAliveHead.data(), item.keepAliveHead.size());
+        Entry entry = { string_view(keepAliveHead, item.keepAliveHead.size()),
+                        string_view(closeHead, item.closeHead.size()), string_view(body, file.size) };
+        image->index_.emplace(string_view(path, file.rel.size()), entry);
+    }
+    mprotect(image->data_, image->size_, PROT_READ);
+    return image;
+}
+
+const shared_ptr<const StaticImage>& StaticImage::Current() {
+    thread_local shared_ptr<const StaticImage> local;
+    thread_local uint64_t localGen = 0;
+    if(g_currentGen.load(memory_order_acquire) != localGen) {
+        lock_guard<mutex> locker(g_currentMtx);
+        local = g_current;
+        localGen = g_currentGen.load(memory_order_relaxed);
+    }
+    return local;
+}
+
+bool StaticImage::HasCurrent() {
+    lock_guard<mutex> locker(g_currentMtx);
+    return g_current != nullptr;
+}
+
+void StaticImage::Swap(shared_ptr<const StaticImage> next) {
+    lock_guard<mutex> locker(g_currentMtx);
+    g_current.swap(next);
+    g_currentGen.fetch_add(1, memory_order_release);
+    // 旧镜像在锁外面释放，还有线程或者发送队列引用着的话等它们放掉
+}
+
+ImageBuilder* ImageBuilder::Instance() {
+    static ImageBuilder inst;
+    return &inst;
+}
+
+ImageBuilder::~ImageBuilder() {
+    Stop();
+}
+
+bool ImageBuilder::Start(const string& srcDir, const StaticImage::Options& options) {
+    Stop();
+    srcDir_ = srcDir;
+    options_ = options;
+    auto begin = chrono::steady_clock::now();
+    shared_ptr<const StaticImage> image = StaticImage::Build(srcDir_, options_);
+    if(!image) { return false; }
+    StaticImage::Swap(image);
+    LOG_INFO("Static image: %zu files, %zu bytes, %lldms", image->Files(), image->Bytes(),
+                (long long)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count());
+    stop_ = false;
+    built_ = seq_;
+    thread_.reset(new thread(&ImageBuilder::Loop_, this));
+    return true;
+}
+
+void ImageBuilder::Invalidate() {
+    if(!thread_) { return; }
+    lock_guard<mutex> locker(mtx_);
+    seq_++;
+    // 旧镜像里的内容可能已经过时了，重建好之前走磁盘
+    if(StaticImage::HasCurrent()) { StaticImage::Swap(nullptr); }
+    cond_.notify_one();
+}
+
+void ImageBuilder::Rebuild() {
+    if(!thread_) { return; }
+    lock_guard<mutex> locker(mtx_);
+    seq_++;
+    cond_.notify_one();
+}
+
+void ImageBuilder::Stop() {
+    if(!thread_) { return; }
+    {
+        lock_guard<mutex> locker(mtx_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    thread_->join();
+    thread_.reset();
+    StaticImage::Swap(nullptr);
+}
+
+void ImageBuilder::Loop_() {
+    unique_lock<mutex> locker(mtx_);
+    while(true) {
+        cond_.wait(locker, [this] { return stop_ || seq_ != built_; });
+        // 等到DEBOUNCE_MS之内没有新的变化
+        uint64_t seq;
+        do {
+            seq = seq_;
+            cond_.wait_for(locker, chrono::milliseconds(DEBOUNCE_MS), [&] { return stop_ || seq_ != seq; });
+        } while(!stop_ && seq_ != seq);
+        if(stop_) { break; }
+
+        locker.unlock();
+        auto begin = chrono::steady_clock::now();
+        shared_ptr<const StaticImage> image = StaticImage::Build(srcDir_, options_);
+        long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+        locker.lock();
+        // 建的过程中文件又变了，这次建的可能是一半新一半旧
+        if(seq_ != seq) { continue; }
+        built_ = seq;
+        if(!image) {
+            LOG_WARN("Rebuild static image error, serve from disk");
+            continue;
+        }
+        StaticImage::Swap(image);
+        rebuilds_++;
+        LOG_INFO("Static image rebuilt: %zu files, %zu bytes, %lldms", image->Files(), image->Bytes(), ms);
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-27
+ * @copyleft Apache 2.0
+ */
+#ifndef STATIC_IMAGE_H
+#define STATIC_IMAGE_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+
+// 资源目录的预加载镜像：启动时把所有小文件连同生成好的200响应头打包进一块只读内存，
+// 命中时响应头直接拷贝，文件内容作为内存段发出去，不碰文件系统，第一个请求就不会缺页或者冷打开。
+// 镜像建好以后不再修改，索引也不变，查找不用加锁；换镜像时整个替换，
+// 已经入队的响应持有旧镜像的引用，发完才释放。
+class StaticImage {
+public:
+    struct Options {
+        size_t maxBytes = 64 << 20;     // 镜像最大的大小，装不下的文件不预加载
+        size_t maxFileBytes = 1 << 20;  // 比这大的文件不预加载，还是用sendfile
+    };
+
+    // 一个文件，都指向镜像里的内存
+    struct Entry {
+        std::string_view keepAliveHead;     // 长连接的响应头
+        std::string_view closeHead;         // 短连接的响应头
+        std::string_view body;
+    };
+
+    ~StaticImage();
+    StaticImage(const StaticImage&) = delete;
+    StaticImage& operator=(const StaticImage&) = delete;
+
+    // 扫描srcDir建一个新镜像，失败返回空
+    static std::shared_ptr<const StaticImage> Build(const std::string& srcDir, const Options& options);
+
+    // path是请求路径，比如/index.html，没有时返回空
+    const Entry* Find(std::string_view path) const {
+        auto it = index_.find(path);
+        return it == index_.end() ? nullptr : &it->second;
+    }
+    size_t Files() const { return index_.size(); }
+    size_t Bytes() const { return size_; }
+
+    // 当前生效的镜像，没有时为空。每个线程缓存一份引用，换镜像时代数加一，
+    // 线程发现代数变了才去锁里重新取，平时只有一次原子读；空闲的线程在下一个请求时才放掉旧镜像
+    static const std::shared_ptr<const StaticImage>& Current();
+    static void Swap(std::shared_ptr<const StaticImage> next);
+    // 有没有生效的镜像，在锁里看，不经过线程缓存，不提供文件的线程用它就不会拿着旧镜像不放
+    static bool HasCurrent();
+
+private:
+    StaticImage() = default;
+
+    char* data_ = nullptr;      // mmap出来的一整块，建好以后改成只读
+    size_t size_ = 0;
+    std::unordered_map<std::string_view, Entry> index_;     // 键也在镜像里
+};
+
+// 在后台线程里重建镜像。文件变了先停用当前镜像(之后的请求走磁盘)，
+// 等一段时间没有新的变化再重建，部署时一次拷很多文件只重建一次；
+// 重建期间又有变化的话这次的结果不用，接着再建
+class ImageBuilder {
+public:
+    static ImageBuilder* Instance();
+
+    bool Start(const std::string& srcDir, const StaticImage::Options& options);    // 同步建第一个镜像，再启动后台线程
+    void Invalidate();  // 资源目录里的文件变了
+    void Rebuild();     // 不停用当前镜像，在后台重建，比如重新加载配置时
+    void Stop();
+
+    uint64_t Rebuilds() const { return rebuilds_; }
+
+private:
+    ImageBuilder() = default;
+    ~ImageBuilder();
+
+    void Loop_();
+
+    static constexpr int DEBOUNCE_MS = 200;     // 最后一次变化之后等这么久再重建
+
+    std::string srcDir_;
+    StaticImage::Options options_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    uint64_t seq_ = 0;          // 每次请求重建加一
+    uint64_t built_ = 0;        // 当前镜像对应的seq_
+    bool stop_ = false;
+    std::atomic<uint64_t> rebuilds_{0};
+    std::unique_ptr<std::thread> thread_;
+};
+
+#endif //STATIC_IMAGE_H
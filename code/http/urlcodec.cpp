@@ -0,0 +1,107 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-25
+ * @copyleft Apache 2.0
+ */ 
+#include "urlcodec.h"
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// 十六进制字符到数值的表，不是十六进制字符的是-1
+struct HexTable {
+    int8_t val[256];
+    constexpr HexTable(): val() {
+        for(int i = 0; i < 256; i++) {
+            val[i] = (i >= '0' && i <= '9') ? i - '0' :
+                     (i >= 'a' && i <= 'f') ? i - 'a' + 10 :
+                     (i >= 'A' && i <= 'F') ? i - 'A' + 10 : -1;
+        }
+    }
+};
+
+constexpr HexTable HEX;
+static_assert(HEX.val['F'] == 15 && HEX.val['g'] == -1, "bad hex table");
+
+} // namespace
+
+size_t UrlCodec::FindEscape_(const char* data, size_t len, bool plusAsSpace) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // 大部分路径和表单值里没有转义，整块跳过
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8(plusAsSpace ? '+' : '%');
+    for(; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, pct), _mm_cmpeq_epi8(chunk, plus)));
+        if(mask) { return i + __builtin_ctz(mask); }
+    }
+#endif
+    for(; i < len; i++) {
+        if(data[i] == '%' || (plusAsSpace && data[i] == '+')) { return i; }
+    }
+    return len;
+}
+
+size_t UrlCodec::Decode(char* data, size_t len, bool plusAsSpace) {
+    size_t r = FindEscape_(data, len, plusAsSpace);
+    size_t w = r;
+    while(r < len) {
+        char ch = data[r];
+        if(ch == '+') {
+            data[w++] = ' ';
+            r++;
+        }
+        else {
+            int hi = r + 2 < len ? HEX.val[static_cast<uint8_t>(data[r + 1])] : -1;
+            int lo = r + 2 < len ? HEX.val[static_cast<uint8_t>(data[r + 2])] : -1;
+            if(hi >= 0 && lo >= 0) {
+                data[w++] = static_cast<char>(hi << 4 | lo);
+                r += 3;
+            } else {
+                data[w++] = ch;
+                r++;
+            }
+        }
+        // 两个转义之间的普通字符整段搬过去
+        size_t next = r + FindEscape_(data + r, len - r, plusAsSpace);
+        if(w != r) { memmove(data + w, data + r, next - r); }
+        w += next - r;
+        r = next;
+    }
+    return w;
+}
+
+bool UrlCodec::NormalizePath(char* data, size_t len, size_t* outLen) {
+    len = Decode(data, len, false);
+    if(len == 0 || data[0] != '/' || memchr(data, '\0', len)) { return false; }
+    // 写的位置不会超过读的位置，可以原地处理
+    size_t w = 0, i = 0;
+    bool dirSlash = false;  // 结尾要不要保留/
+    while(i < len) {
+        while(i < len && data[i] == '/') { i++; }
+        size_t begin = i;
+        while(i < len && data[i] != '/') { i++; }
+        size_t segLen = i - begin;
+        dirSlash = true;
+        if(segLen == 0 || (segLen == 1 && data[begin] == '.')) { continue; }
+        if(segLen == 2 && data[begin] == '.' && data[begin + 1] == '.') {
+            if(w == 0) { return false; }
+            while(w > 0 && data[w - 1] != '/') { w--; }
+            w--;    // 去掉前面的/
+            continue;
+        }
+        data[w++] = '/';
+        memmove(data + w, data + begin, segLen);
+        w += segLen;
+        dirSlash = (i < len);
+    }
+    if(w == 0 || dirSlash) { data[w++] = '/'; }
+    *outLen = w;
+    return true;
+}
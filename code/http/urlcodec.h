@@ -0,0 +1,27 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-25
+ * @copyleft Apache 2.0
+ */ 
+#ifndef URL_CODEC_H
+#define URL_CODEC_H
+
+#include <stddef.h>
+
+// URL的百分号解码和路径规范化，都是原地修改，不分配内存
+class UrlCodec {
+public:
+    // 原地解码%XX，plusAsSpace为true时把+换成空格(表单)，返回解码后的长度
+    // 不合法的%原样保留
+    static size_t Decode(char* data, size_t len, bool plusAsSpace);
+
+    // 解码请求路径并规范化：合并多个/，去掉.，..回退到上一级，返回false表示路径不合法
+    // (不是以/开头，含有\0，或者..跑到了根目录外面)
+    static bool NormalizePath(char* data, size_t len, size_t* outLen);
+
+private:
+    // 找下一个需要处理的字符(%或者+)，没有就返回len，SSE2一次看16个字节
+    static size_t FindEscape_(const char* data, size_t len, bool plusAsSpace);
+};
+
+#endif //URL_CODEC_H
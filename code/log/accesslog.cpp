@@ -0,0 +1,346 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "accesslog.h"
+
+#include <charconv>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>         // IOV_MAX
+#include <sys/uio.h>        // writev
+#include <sys/stat.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include "../pool/affinity.h"
+
+using namespace std;
+
+namespace {
+
+void AppendNum(string& out, uint64_t value) {
+    char buf[24];
+    auto ret = to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, ret.ptr - buf);
+}
+
+// json里转义"和\和控制字符；common格式和nginx一样把"、\和不可见字符写成\xHH
+void AppendEscaped(string& out, string_view str, bool json) {
+    static const char HEX[] = "0123456789abcdef";
+    size_t begin = 0;
+    for(size_t i = 0; i < str.size(); i++) {
+        unsigned char ch = str[i];
+        if(ch >= 0x20 && ch != '"' && ch != '\\' && ch != 0x7f) { continue; }
+        out.append(str.data() + begin, i - begin);
+        begin = i + 1;
+        if(json && (ch == '"' || ch == '\\')) {
+            out += '\\';
+            out += ch;
+        } else if(json) {
+            out.append("\\u00", 4);
+            out += HEX[ch >> 4];
+            out += HEX[ch & 0xf];
+        } else {
+            out.append("\\x", 2);
+            out += HEX[ch >> 4];
+            out += HEX[ch & 0xf];
+        }
+    }
+    out.append(str.data() + begin, str.size() - begin);
+}
+
+// 时间戳每秒只格式化一次，每个线程各自缓存
+struct TimeCache {
+    time_t sec = -1;
+    char common[40];    // 19/Oct/2020:14:48:46 +0800
+    char iso[40];       // 2020-10-19T14:48:46+0800
+    size_t commonLen = 0;
+    size_t isoLen = 0;
+};
+
+const TimeCache& Now() {
+    thread_local TimeCache cache;
+    time_t sec = time(nullptr);
+    if(sec != cache.sec) {
+        struct tm t;
+        localtime_r(&sec, &t);
+        cache.commonLen = strftime(cache.common, sizeof(cache.common), "%d/%b/%Y:%H:%M:%S %z", &t);
+        cache.isoLen = strftime(cache.iso, sizeof(cache.iso), "%Y-%m-%dT%H:%M:%S%z", &t);
+        cache.sec = sec;
+    }
+    return cache;
+}
+
+int64_t NowSec() {
+    return chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+AccessLog* AccessLog::Instance() {
+    static AccessLog inst;
+    return &inst;
+}
+
+AccessLog::~AccessLog() {
+    Close();
+}
+
+bool AccessLog::Init(const Options& options) {
+    Close();
+    options_ = options;
+    if(options_.path.empty()) { return true; }
+    if(options_.sample < 1) { options_.sample = 1; }
+    if(!OpenFile_()) { return false; }
+    stop_ = false;
+    writer_.reset(new thread(&AccessLog::WriterLoop_, this));
+    isOpen_ = true;
+    return true;
+}
+
+void AccessLog::Close() {
+    isOpen_ = false;
+    if(writer_) {
+        {
+            lock_guard<mutex> locker(mtx_);
+            stop_ = true;
+        }
+        cond_.notify_one();
+        writer_->join();
+        writer_.reset();
+    }
+    if(fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool AccessLog::PinWriter(const vector<int>& cpus) {
+    if(!writer_) { return true; }
+    return CpuAffinity::Pin(writer_->native_handle(), cpus);
+}
+
+bool AccessLog::ShouldRecord(int status) {
+    if(status >= 400 || options_.sample <= 1) { return true; }
+    // 每个线程自己计数，不用原子操作
+    thread_local uint32_t count = 0;
+    return ++count % options_.sample == 0;
+}
+
+AccessLog::Slot* AccessLog::LocalSlot_() {
+    // 线程第一次写时注册，线程池的线程一直活着，slot不回收
+    thread_local Slot* slot = nullptr;
+    if(!slot) {
+        lock_guard<mutex> locker(mtx_);
+        slots_.emplace_back(new Slot);
+        slot = slots_.back().get();
+        slot->buf.reserve(SLOT_FLUSH + 1024);
+    }
+    return slot;
+}
+
+void AccessLog::Record(const Entry& entry) {
+    Slot* slot = LocalSlot_();
+    lock_guard<mutex> locker(slot->mtx);
+    Format_(entry, slot->buf);
+    if(slot->buf.size() >= SLOT_FLUSH) {
+        Handoff_(slot);
+    }
+}
+
+void AccessLog::Format_(const Entry& entry, string& out) {
+    const TimeCache& now = Now();
+    if(options_.format == JSON) {
+        out.append("{\"time\":\"", 9);
+        out.append(now.iso, now.isoLen);
+        out.append("\",\"client\":\"", 12);
+        out.append(entry.client.data(), entry.client.size());
+        out.append("\",\"method\":\"", 12);
+        AppendEscaped(out, entry.method, true);
+        out.append("\",\"path\":\"", 10);
+        AppendEscaped(out, entry.path, true);
+        out.append("\",\"version\":\"", 13);
+        AppendEscaped(out, entry.version, true);
+        out.append("\",\"status\":", 11);
+        AppendNum(out, entry.status);
+        out.append(",\"bytes\":", 9);
+        AppendNum(out, entry.bytes);
+        out.append(",\"us\":", 6);
+        AppendNum(out, entry.durationUs);
+        out.append(",\"reuse\":", 9);
+        AppendNum(out, entry.reuse);
+        out.append("}\n", 2);
+        return;
+    }
+    // client - - [time] "GET /path HTTP/1.1" status bytes us reuse
+    out.append(entry.client.data(), entry.client.size());
+    out.append(" - - [", 6);
+    out.append(now.common, now.commonLen);
+    out.append("] \"", 3);
+    AppendEscaped(out, entry.method, false);
+    out += ' ';
+    AppendEscaped(out, entry.path, false);
+    out.append(" HTTP/", 6);
+    AppendEscaped(out, entry.version, false);
+    out.append("\" ", 2);
+    AppendNum(out, entry.status);
+    out += ' ';
+    AppendNum(out, entry.bytes);
+    out += ' ';
+    AppendNum(out, entry.durationUs);
+    out += ' ';
+    AppendNum(out, entry.reuse);
+    out += '\n';
+}
+
+void AccessLog::Handoff_(Slot* slot) {
+    string next;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(full_.size() >= MAX_PENDING) {
+            // 磁盘跟不上，丢掉这一批，不能让请求线程等磁盘
+            dropped_ += slot->buf.size();
+            slot->buf.clear();
+            return;
+        }
+        full_.push_back(std::move(slot->buf));
+        if(!free_.empty()) {
+            next = std::move(free_.back());
+            free_.pop_back();
+        }
+    }
+    cond_.notify_one();
+    slot->buf = std::move(next);
+    slot->buf.reserve(SLOT_FLUSH + 1024);
+}
+
+void AccessLog::WriterLoop_() {
+    vector<string> bufs;
+    vector<Slot*> slots;
+    vector<string> spares;
+    bool stopping = false;
+    while(!stopping) {
+        {
+            unique_lock<mutex> locker(mtx_);
+            cond_.wait_for(locker, chrono::milliseconds(options_.flushMs),
+                           [this] { return stop_ || !full_.empty(); });
+            stopping = stop_;
+            for(auto& buf: full_) { bufs.push_back(std::move(buf)); }
+            full_.clear();
+            slots.clear();
+            for(auto& slot: slots_) { slots.push_back(slot.get()); }
+            // 每个线程的缓冲区换出来时换一个有容量的空缓冲区进去
+            while(!free_.empty() && spares.size() < slots.size()) {
+                spares.push_back(std::move(free_.back()));
+                free_.pop_back();
+            }
+        }
+        // 到时间了，把各个线程没攒满的缓冲区也换出来
+        for(Slot* slot: slots) {
+            string next;
+            if(!spares.empty()) {
+                next = std::move(spares.back());
+                spares.pop_back();
+            }
+            {
+                lock_guard<mutex> locker(slot->mtx);
+                if(slot->buf.empty()) {
+                    spares.push_back(std::move(next));
+                    continue;
+                }
+                swap(next, slot->buf);
+            }
+            bufs.push_back(std::move(next));
+        }
+        WriteAll_(bufs);
+        {
+            lock_guard<mutex> locker(mtx_);
+            for(auto& buf: bufs) {
+                buf.clear();
+                if(free_.size() < slots_.size() + 4) { free_.push_back(std::move(buf)); }
+            }
+        }
+        bufs.clear();
+    }
+}
+
+void AccessLog::WriteAll_(vector<string>& bufs) {
+    if(options_.rotateSec > 0 && NowSec() - openedAt_ >= options_.rotateSec) {
+        Rotate_();
+    }
+    size_t i = 0;
+    while(i < bufs.size()) {
+        struct iovec iov[IOV_MAX];
+        int cnt = 0;
+        for(; i < bufs.size() && cnt < IOV_MAX; i++) {
+            if(bufs[i].empty()) { continue; }
+            iov[cnt].iov_base = const_cast<char*>(bufs[i].data());
+            iov[cnt].iov_len = bufs[i].size();
+            cnt++;
+        }
+        int idx = 0;
+        while(idx < cnt) {
+            if(fd_ < 0) { break; }
+            ssize_t len = writev(fd_, iov + idx, cnt - idx);
+            if(len < 0) {
+                if(errno == EINTR) { continue; }
+                break;
+            }
+            written_ += len;
+            fileBytes_ += len;
+            // 跳过写完的，最后一段可能只写了一部分
+            while(idx < cnt && static_cast<size_t>(len) >= iov[idx].iov_len) {
+                len -= iov[idx].iov_len;
+                idx++;
+            }
+            if(idx < cnt) {
+                iov[idx].iov_base = static_cast<char*>(iov[idx].iov_base) + len;
+                iov[idx].iov_len -= len;
+            }
+        }
+        for(; idx < cnt; idx++) { dropped_ += iov[idx].iov_len; }
+    }
+    if(options_.maxBytes > 0 && fileBytes_ >= options_.maxBytes) {
+        Rotate_();
+    }
+}
+
+bool AccessLog::OpenFile_() {
+    fd_ = open(options_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd_ < 0 && errno == ENOENT) {
+        // 目录不存在时建一层，和系统日志一样
+        size_t slash = options_.path.rfind('/');
+        if(slash != string::npos && slash > 0) {
+            mkdir(options_.path.substr(0, slash).c_str(), 0777);
+            fd_ = open(options_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        }
+    }
+    if(fd_ < 0) { return false; }
+    struct stat st;
+    fileBytes_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+    openedAt_ = NowSec();
+    return true;
+}
+
+// 当前文件改名为path.年月日-时分秒，再打开一个新的
+void AccessLog::Rotate_() {
+    if(fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    time_t sec = time(nullptr);
+    struct tm t;
+    localtime_r(&sec, &t);
+    char suffix[32];
+    strftime(suffix, sizeof(suffix), ".%Y%m%d-%H%M%S", &t);
+    string rotated = options_.path + suffix;
+    // 同一秒切了好几次
+    for(int i = 1; access(rotated.c_str(), F_OK) == 0; i++) {
+        rotated = options_.path + suffix + "." + to_string(i);
+    }
+    rename(options_.path.c_str(), rotated.c_str());
+    OpenFile_();
+}
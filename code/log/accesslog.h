@@ -0,0 +1,101 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+
+// 访问日志，每个请求一行，common(类似nginx的combined)或者json格式
+// 记录先格式化进每个线程自己的缓冲区，只有本线程和写线程会去锁它，几乎没有竞争；
+// 缓冲区满了或者到了flushMs，写线程把所有缓冲区换出来，用writev一次写进文件。
+// 按大小和时间切分文件，切分也在写线程里做；sample大于1时只记录1/sample的成功请求，出错的请求都记
+class AccessLog {
+public:
+    enum FORMAT { COMMON, JSON };
+
+    struct Options {
+        std::string path;               // 文件路径，为空表示关闭
+        FORMAT format = COMMON;
+        int sample = 1;                 // 成功的请求每sample个记一个
+        long long maxBytes = 0;         // 文件超过这么大就切分，0表示不按大小切分
+        int rotateSec = 0;              // 每隔这么多秒切分一次，0表示不按时间切分
+        int flushMs = 200;              // 缓冲区里的记录最多等这么久就写进文件
+    };
+
+    // 一个请求的信息，字符串都只在Record调用期间有效
+    struct Entry {
+        std::string_view client;
+        std::string_view method;
+        std::string_view path;
+        std::string_view version;
+        int status;
+        uint64_t bytes;         // 响应的字节数，包括响应头
+        uint64_t durationUs;    // 从开始读请求到响应写完
+        int reuse;              // 这是连接上的第几个请求，从0开始
+    };
+
+    static AccessLog* Instance();
+
+    bool Init(const Options& options);
+    void Close();   // 停掉写线程，把缓冲区里剩下的都写进文件
+
+    bool IsOpen() const { return isOpen_.load(std::memory_order_relaxed); }
+    bool PinWriter(const std::vector<int>& cpus);  // 把写线程绑定到这些CPU上
+
+    // 是否要记录这个请求，按状态码和采样率决定，在格式化之前调用
+    bool ShouldRecord(int status);
+    void Record(const Entry& entry);
+
+    uint64_t Written() const { return written_; }   // 写进文件的字节数
+    uint64_t Dropped() const { return dropped_; }   // 写线程跟不上时丢掉的字节数
+
+private:
+    // 每个线程一个缓冲区
+    struct Slot {
+        std::mutex mtx;
+        std::string buf;
+    };
+
+    AccessLog() = default;
+    ~AccessLog();
+
+    Slot* LocalSlot_();
+    void Format_(const Entry& entry, std::string& out);
+    void Handoff_(Slot* slot);  // 本线程的缓冲区满了，交给写线程
+    void WriterLoop_();
+    void WriteAll_(std::vector<std::string>& bufs);
+    bool OpenFile_();
+    void Rotate_();
+
+    static const size_t SLOT_FLUSH = 64 * 1024;     // 缓冲区攒到这么多就交给写线程
+    static const size_t MAX_PENDING = 64;           // 等着写的缓冲区超过这么多个时丢掉新的，不让内存涨上去
+
+    Options options_;
+    std::atomic<bool> isOpen_{false};
+    bool stop_ = false;
+    int fd_ = -1;
+    long long fileBytes_ = 0;
+    int64_t openedAt_ = 0;          // 当前文件打开的时间，秒
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> dropped_{0};
+
+    std::mutex mtx_;                // 保护slots_、full_、free_、stop_
+    std::condition_variable cond_;
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::vector<std::string> full_;     // 已经写满等着写进文件的缓冲区
+    std::vector<std::string> free_;     // 写完的缓冲区，留着容量复用
+    std::unique_ptr<std::thread> writer_;
+};
+
+#endif //ACCESS_LOG_H
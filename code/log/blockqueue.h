@@ -8,13 +8,21 @@
 
 #include <mutex>
 #include <deque>
+#include <vector>
+#include <atomic>
 #include <condition_variable>
 #include <sys/time.h>
 
 template<class T>
 class BlockDeque {
 public:
-    explicit BlockDeque(size_t MaxCapacity = 1000);  // 初始化capacity大小
+    // 队列满时try_push怎么办：
+    // BLOCK和DROP_NEWEST丢掉新来的；DROP_OLDEST挤掉最老的；
+    // SAMPLE每sampleRate个新来的留一个(挤掉最老的)，其余丢掉，过载时还能看到一部分新内容
+    enum POLICY { BLOCK, DROP_OLDEST, DROP_NEWEST, SAMPLE };
+
+    explicit BlockDeque(size_t MaxCapacity = 1000, POLICY policy = BLOCK,
+                        size_t sampleRate = 10);  // 初始化capacity大小
 
     ~BlockDeque();
 
@@ -38,6 +46,12 @@ public:
 
     void push_front(const T &item); // 获取队尾
 
+    bool try_push(T item); // 放入队尾，满了按policy处理，从不阻塞，返回新来的是否放进去了
+
+    bool pop_all(std::vector<T> &items); // 一次取出全部，队列为空时阻塞，关闭时返回false
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); } // 满了丢掉的个数
+
     bool pop(T &item); // 从队头取出一个任务
 
     bool pop(T &item, int timeout); // 从队头取出一个任务，计时阻塞，没有用到
@@ -53,6 +67,14 @@ private:
 
     bool isClose_;     //  是否关闭
 
+    POLICY policy_;     // 满了以后try_push的处理方式
+
+    size_t sampleRate_;  // SAMPLE时每多少个留一个
+
+    size_t overflowCount_;  // SAMPLE时满了以后来了多少个
+
+    std::atomic<uint64_t> dropped_;  // 丢掉的个数
+
     std::condition_variable condConsumer_;   // 消费者条件变量
 
     std::condition_variable condProducer_;   //  生产者条件变量
@@ -60,9 +82,12 @@ private:
 
 // 初始化capacity大小
 template<class T>
-BlockDeque<T>::BlockDeque(size_t MaxCapacity) :capacity_(MaxCapacity) {
+BlockDeque<T>::BlockDeque(size_t MaxCapacity, POLICY policy, size_t sampleRate)
+    :capacity_(MaxCapacity), policy_(policy), sampleRate_(sampleRate), dropped_(0) {
     assert(MaxCapacity > 0);
+    if(sampleRate_ == 0) { sampleRate_ = 1; }
     isClose_ = false;
+    overflowCount_ = 0;
 }
 
 template<class T>
@@ -140,6 +165,23 @@ void BlockDeque<T>::push_front(const T &item) {
     // 呼叫消费者可以拿了
     condConsumer_.notify_one();
 }
+// 放入队尾，满了不等，按policy_丢掉新的或者老的
+template<class T>
+bool BlockDeque<T>::try_push(T item) {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(deq_.size() >= capacity_) {
+            bool keep = policy_ == DROP_OLDEST ||
+                        (policy_ == SAMPLE && ++overflowCount_ % sampleRate_ == 0);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            if(!keep) { return false; }
+            deq_.pop_front();
+        }
+        deq_.push_back(std::move(item));
+    }
+    condConsumer_.notify_one();
+    return true;
+}
 // 看队列是否为空
 template<class T>
 bool BlockDeque<T>::empty() {
@@ -157,10 +199,11 @@ template<class T>
 bool BlockDeque<T>::pop(T &item) {
     std::unique_lock<std::mutex> locker(mtx_);
     while(deq_.empty()){
-        condConsumer_.wait(locker);
+        // 先看是否关闭，Close在消费者进来之前调用时不会再有人唤醒它
         if(isClose_){
             return false;
         }
+        condConsumer_.wait(locker);
     }
     item = deq_.front();
     deq_.pop_front();
@@ -168,6 +211,27 @@ bool BlockDeque<T>::pop(T &item) {
     condProducer_.notify_one();
     return true;
 }
+// 一次把队列里的都取出来，只加一次锁，items原来的内容会被清掉
+template<class T>
+bool BlockDeque<T>::pop_all(std::vector<T> &items) {
+    items.clear();
+    {
+        std::unique_lock<std::mutex> locker(mtx_);
+        while(deq_.empty()){
+            if(isClose_){
+                return false;
+            }
+            condConsumer_.wait(locker);
+        }
+        for(auto &item: deq_) {
+            items.push_back(std::move(item));
+        }
+        deq_.clear();
+    }
+    // 腾空了，等着的生产者都可以放了
+    condProducer_.notify_all();
+    return true;
+}
 //从队头取出一个任务，计时阻塞，没有用到
 template<class T>
 bool BlockDeque<T>::pop(T &item, int timeout) {
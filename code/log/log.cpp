@@ -4,16 +4,26 @@
  * @copyleft Apache 2.0
  */ 
 #include "log.h"
+#include <spawn.h>          // posix_spawnp
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../pool/affinity.h"
 
 using namespace std;
 
+extern char** environ;
+
 // 初始化一些变量
-Log::Log() {
-    lineCount_ = 0;
+Log::Log(): reportedDrops_(0) {
     isAsync_ = false;
     writeThread_ = nullptr;
     deque_ = nullptr;
-    toDay_ = 0;
+    date_[0] = '\0';
+    fileIndex_ = 0;
+    fileBytes_ = 0;
+    maxBytes_ = 0;
+    compress_ = false;
+    overflow_ = LogQueue::DROP_NEWEST;
     fp_ = nullptr;
 }
 
@@ -28,11 +38,14 @@ Log::~Log() {
         // 回收线程
         writeThread_->join();
     }
+    lock_guard<mutex> locker(fileMtx_);
     if(fp_) {
-        lock_guard<mutex> locker(mtx_);
-        flush();
+        fflush(fp_);
         fclose(fp_);
+        fp_ = nullptr;
     }
+    // 没压缩完的gzip不用等，进程退出以后它自己会做完
+    ReapCompress_();
 }
 // 获取日志系统等级
 int Log::GetLevel() {
@@ -45,94 +58,67 @@ void Log::SetLevel(int level) {
     level_ = level;
 }
 
+// 同步写的时候没有写线程，什么也不做
+bool Log::PinWriter(const std::vector<int>& cpus) {
+    if(!writeThread_) { return true; }
+    return CpuAffinity::Pin(writeThread_->native_handle(), cpus);
+}
+
 // 初始化日志系统
 void Log::init(int level = 1, const char* path, const char* suffix,
-    int maxQueueSize) {
+    int maxQueueSize, long long maxBytes, bool compress, LogQueue::POLICY overflow) {
     isOpen_ = true;
     level_ = level;
-    if(maxQueueSize > 0) {
-        isAsync_ = true;
-        // 
-        if(!deque_) {
-            unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-            deque_ = move(newDeque);
-            
-            std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
-            writeThread_ = move(NewThread);
-        }
-    } else {
-        isAsync_ = false;
-    }
-
-    lineCount_ = 0;
 
     time_t timer = time(nullptr);
-    struct tm *sysTime = localtime(&timer);
-    struct tm t = *sysTime;
-    path_ = path;
-    suffix_ = suffix;
-    char fileName[LOG_NAME_LEN] = {0};
-    // 将fileName格式化成  路径+ 年月日 + 后缀
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", 
-            path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
-    toDay_ = t.tm_mday;
-
+    struct tm t;
+    localtime_r(&timer, &t);
     {
-        lock_guard<mutex> locker(mtx_);
-        buff_.RetrieveAll();
+        // 写线程可能已经在跑了(重复init)，换文件要和它互斥
+        lock_guard<mutex> locker(fileMtx_);
         // 如果文件指针存在，需要先给他全写入文件先
-        if(fp_) { 
-            flush();
-            fclose(fp_); 
+        if(fp_) {
+            fflush(fp_);
+            fclose(fp_);
+            fp_ = nullptr;
         }
-        // 新开一个文件描述符
-        fp_ = fopen(fileName, "a");
-        if(fp_ == nullptr) {
-            mkdir(path_, 0777);
-            fp_ = fopen(fileName, "a");
-        } 
+        path_ = path;
+        suffix_ = suffix;
+        maxBytes_ = maxBytes;
+        compress_ = compress;
+        strftime(date_, sizeof(date_), "%Y-%m-%d", &t);
+        fileIndex_ = 0;
+        OpenFile_();
         assert(fp_ != nullptr);
     }
+    {
+        lock_guard<mutex> locker(mtx_);
+        buff_.RetrieveAll();
+    }
+
+    if(maxQueueSize > 0) {
+        isAsync_ = true;
+        if(!deque_) {
+            // 策略在队列创建时定下来，重复init时不变
+            overflow_ = overflow;
+            deque_.reset(new LogQueue(maxQueueSize, overflow, OVERFLOW_SAMPLE));
+            writeThread_.reset(new thread(FlushLogThread));
+        }
+    } else {
+        isAsync_ = false;
+    }
 }
-// 日志写操作
+// 日志写操作，只负责格式化，异步时文件的读写和切换都在写线程里做
 void Log::write(int level, const char *format, ...) {
     struct timeval now = {0, 0};
     gettimeofday(&now, nullptr);
     time_t tSec = now.tv_sec;
-    struct tm *sysTime = localtime(&tSec);
-    struct tm t = *sysTime;
+    struct tm t;
+    localtime_r(&tSec, &t);
     va_list vaList;
 
-    /* 日志日期 日志行数 */
-    if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_  %  MAX_LINES == 0)))
-    {
-        unique_lock<mutex> locker(mtx_);
-        locker.unlock();
-        
-        char newFile[LOG_NAME_LEN];
-        char tail[36] = {0};
-        snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
-
-        if (toDay_ != t.tm_mday)
-        {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
-            toDay_ = t.tm_mday;
-            lineCount_ = 0;
-        }
-        else {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_  / MAX_LINES), suffix_);
-        }
-        
-        locker.lock();
-        flush();
-        fclose(fp_);
-        fp_ = fopen(newFile, "a");
-        assert(fp_ != nullptr);
-    }
-
     {
         unique_lock<mutex> locker(mtx_);
-        lineCount_++;
         int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
                     t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
                     t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
@@ -145,12 +131,18 @@ void Log::write(int level, const char *format, ...) {
         va_end(vaList);
 
         buff_.HasWritten(m);
-        buff_.Append("\n\0", 2);
+        buff_.Append("\n", 1);
 
-        if(isAsync_ && deque_ && !deque_->full()) {
-            deque_->push_back(buff_.RetrieveAllToStr());
+        if(isAsync_ && deque_) {
+            // 写线程跟不上时按队列的策略丢掉一些行，不能让请求线程去碰文件；BLOCK时才等
+            if(overflow_ == LogQueue::BLOCK) {
+                deque_->push_back(buff_.RetrieveAllToStr());
+            } else {
+                deque_->try_push(buff_.RetrieveAllToStr());
+            }
         } else {
-            fputs(buff_.Peek(), fp_);
+            lock_guard<mutex> fileLocker(fileMtx_);
+            Write_(buff_.Peek(), buff_.ReadableBytes());
         }
         buff_.RetrieveAll();
     }
@@ -177,19 +169,121 @@ void Log::AppendLogLevelTitle_(int level) {
 }
 // 刷新缓冲区 
 void Log::flush() {
-    // 这时已经可以唤醒线程继续写日志了
+    // 异步时只唤醒写线程，由它写完以后自己刷
     if(isAsync_) { 
         deque_->flush(); 
+        return;
     }
-    fflush(fp_);
+    lock_guard<mutex> locker(fileMtx_);
+    if(fp_) { fflush(fp_); }
 }
 // 异步写
 void Log::AsyncWrite_() {
-    string str = "";
-    // 从deque_从取出一个string然后写入文件
-    while(deque_->pop(str)) {
-        lock_guard<mutex> locker(mtx_);
-        fputs(str.c_str(), fp_);
+    vector<string> lines;
+    // 一次把deque_里的都取出来，只加一次锁，写完整批再刷
+    while(deque_->pop_all(lines)) {
+        lock_guard<mutex> locker(fileMtx_);
+        for(const string& line: lines) {
+            Write_(line.data(), line.size());
+        }
+        WriteDropped_();
+        if(fp_) { fflush(fp_); }
+    }
+}
+
+// 上次以后有丢掉的行，在文件里记一笔，不然看日志的人不知道少了东西
+void Log::WriteDropped_() {
+    uint64_t dropped = deque_->dropped();
+    if(dropped == reportedDrops_) { return; }
+    struct timeval now = {0, 0};
+    gettimeofday(&now, nullptr);
+    struct tm t;
+    localtime_r(&now.tv_sec, &t);
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%d-%02d-%02d %02d:%02d:%02d.%06ld [warn] : log queue full, dropped %lu lines\n",
+                     t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec,
+                     static_cast<unsigned long>(dropped - reportedDrops_));
+    reportedDrops_ = dropped;
+    Write_(line, min(static_cast<size_t>(n), sizeof(line) - 1));
+}
+
+void Log::Write_(const char* line, size_t len) {
+    // 每行开头是日期，比当前文件新就换到那天的文件，保证每行落在自己那天的文件里；
+    // 跨天时几个线程的行可能前后交错，比当前旧的行还写在当前文件里，不切回去
+    if(len >= 10 && memcmp(line, date_, 10) > 0) {
+        Rotate_(line);
+    } else if(maxBytes_ > 0 && fileBytes_ >= maxBytes_) {
+        Rotate_(date_);
+    }
+    if(!fp_) { return; }
+    fwrite(line, 1, len, fp_);
+    fileBytes_ += len;
+}
+
+void Log::Rotate_(const char* date) {
+    string old = FileName_(fileIndex_);
+    if(fp_) {
+        fflush(fp_);
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+    if(memcmp(date, date_, 10) != 0) {
+        memcpy(date_, date, 10);
+        date_[10] = '\0';
+        fileIndex_ = 0;
+    } else {
+        // 跳过已经有的序号，重启后接着往后编
+        do {
+            fileIndex_++;
+        } while(access(FileName_(fileIndex_).c_str(), F_OK) == 0 ||
+                access((FileName_(fileIndex_) + ".gz").c_str(), F_OK) == 0);
+    }
+    if(compress_) { Compress_(old); }
+    // 打不开新文件时丢掉后面的行，下一次切换时再试
+    OpenFile_();
+}
+
+bool Log::OpenFile_() {
+    string name = FileName_(fileIndex_);
+    fp_ = fopen(name.c_str(), "ae");
+    if(fp_ == nullptr) {
+        mkdir(path_.c_str(), 0777);
+        fp_ = fopen(name.c_str(), "ae");
+    }
+    if(fp_ == nullptr) { return false; }
+    struct stat st;
+    fileBytes_ = fstat(fileno(fp_), &st) == 0 ? st.st_size : 0;
+    return true;
+}
+
+// 路径 + 年_月_日 + [-序号] + 后缀
+string Log::FileName_(int index) const {
+    char name[LOG_NAME_LEN] = {0};
+    snprintf(name, LOG_NAME_LEN - 1, "%s/%.4s_%.2s_%.2s", path_.c_str(), date_, date_ + 5, date_ + 8);
+    string ret = name;
+    if(index > 0) { ret += "-" + to_string(index); }
+    return ret + suffix_;
+}
+
+// 起一个gzip进程去压缩，写线程不等它
+void Log::Compress_(const string& file) {
+    ReapCompress_();
+    char* argv[] = { const_cast<char*>("gzip"), const_cast<char*>("-f"),
+                     const_cast<char*>(file.c_str()), nullptr };
+    pid_t pid;
+    if(posix_spawnp(&pid, "gzip", nullptr, nullptr, argv, environ) == 0) {
+        gzips_.push_back(pid);
+    }
+}
+
+void Log::ReapCompress_() {
+    for(size_t i = 0; i < gzips_.size();) {
+        if(waitpid(gzips_[i], nullptr, WNOHANG) != 0) {
+            gzips_[i] = gzips_.back();
+            gzips_.pop_back();
+        } else {
+            i++;
+        }
     }
 }
 
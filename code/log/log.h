@@ -8,7 +8,9 @@
 
 #include <mutex>
 #include <string>
+#include <vector>
 #include <thread>
+#include <sys/types.h>
 #include <sys/time.h>
 #include <string.h>
 #include <stdarg.h>           // vastart va_end
@@ -19,10 +21,16 @@
 
 class Log {
 public:
-    // 初始化日志系统
+    typedef BlockDeque<std::string> LogQueue;
+
+    // 初始化日志系统，maxBytes是单个文件的大小上限(0表示不限)，compress表示切下来的文件用gzip压缩，
+    // overflow是异步队列满了以后的处理方式
     void init(int level, const char* path = "./log", 
                 const char* suffix =".log",
-                int maxQueueCapacity = 1024);
+                int maxQueueCapacity = 1024,
+                long long maxBytes = 0,
+                bool compress = false,
+                LogQueue::POLICY overflow = LogQueue::DROP_NEWEST);
 
     static Log* Instance();  // 单例模式
     static void FlushLogThread(); // 将日志线程原来还剩的内容写入文件中
@@ -33,6 +41,8 @@ public:
     int GetLevel(); // 获取日志系统等级
     void SetLevel(int level); // 设置日志系统等级
     bool IsOpen() { return isOpen_; }  // 日志系统是否打开
+    bool PinWriter(const std::vector<int>& cpus);  // 把异步写线程绑定到这些CPU上
+    uint64_t Dropped() const { return deque_ ? deque_->dropped() : 0; }  // 异步队列满了丢掉的行数
     
 private:
     Log(); // 初始化一些变量
@@ -40,29 +50,42 @@ private:
     virtual ~Log();  // 处理关闭写线程，关闭文件描述符等操作
     void AsyncWrite_();   // 异步写
 
+    // 下面这些只在持有fileMtx_时调用，异步时只有写线程会调用
+    void Write_(const char* line, size_t len);  // 写一行，需要时先切换文件
+    void WriteDropped_();            // 把丢掉的行数写进文件
+    void Rotate_(const char* date);  // 关掉当前文件，换到date这天的文件或者下一个序号
+    bool OpenFile_();                // 打开date_和fileIndex_对应的文件
+    std::string FileName_(int index) const;
+    void Compress_(const std::string& file);  // 后台压缩切下来的文件
+    void ReapCompress_();                     // 回收已经结束的压缩进程
+
 private:
-    static const int LOG_PATH_LEN = 256; // 日志路径名长度
     static const int LOG_NAME_LEN = 256; // 日志文件名长度
-    static const int MAX_LINES = 50000;  // 日志内容的最大行
-
-    const char* path_;      // 路径
-    const char* suffix_; // 后缀名
+    static const int OVERFLOW_SAMPLE = 10; // 队列满了用SAMPLE时每多少行留一行
 
-    int MAX_LINES_;   // 没用到
+    std::string path_;      // 路径
+    std::string suffix_; // 后缀名
 
-    int lineCount_;  // 写了多少行了
-    int toDay_;     // 记录日期
+    char date_[11];         // 当前文件的日期，YYYY-MM-DD，和每行开头的格式一样
+    int fileIndex_;         // 当天的第几个文件，0表示不带序号的那个
+    long long fileBytes_;   // 当前文件的大小
+    long long maxBytes_;    // 超过这么大就换下一个文件，0表示不限
+    bool compress_;         // 切下来的文件是否压缩
+    std::vector<pid_t> gzips_;  // 还没结束的压缩进程
 
     bool isOpen_;   // 日志系统是否打开
  
     Buffer buff_;    // 用缓冲区来写
     int level_;     // 日志等级
     bool isAsync_;  // 是否异步
+    LogQueue::POLICY overflow_;  // 异步队列满了怎么办
+    uint64_t reportedDrops_;    // 已经写进文件的丢弃行数
 
     FILE* fp_;   // 文件指针
     std::unique_ptr<BlockDeque<std::string>> deque_; // 指向日志内容的指针
     std::unique_ptr<std::thread> writeThread_;  // 开启子线程去写
-    std::mutex mtx_; // 锁
+    std::mutex mtx_; // 锁，保护buff_和level_
+    std::mutex fileMtx_;  // 保护fp_和切换文件，异步时只有写线程拿，几乎没有竞争
 };
 
 #define LOG_BASE(level, format, ...) \
@@ -4,16 +4,25 @@
  * @copyleft Apache 2.0
  */ 
 #include <unistd.h>
+#include <stdio.h>
 #include "server/webserver.h"
 
-int main() {
+int main(int argc, char* argv[]) {
     /* 守护进程 后台运行 */
     //daemon(1, 0); 
 
-    WebServer server(
-        1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
-        3306, "root", "root", "webserver", /* Mysql配置 */
-        12, 6, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+    /* 参数见 --help 和 webserver.conf，--config=文件 指定配置文件，--key=value 覆盖单个参数 */
+    Config config;
+    std::string err;
+    if(!config.Load(argc, argv, &err)) {
+        fprintf(stderr, "%s\nrun %s --help for all options\n", err.c_str(), argv[0]);
+        return 1;
+    }
+    if(config.help) {
+        printf("%s", Config::Usage(argv[0]).c_str());
+        return 0;
+    }
+
+    WebServer server(config);
     server.Start();
 } 
-  
\ No newline at end of file
@@ -0,0 +1,167 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-28
+ * @copyleft Apache 2.0
+ */
+#include "metrics.h"
+#include <stdio.h>
+
+using namespace std;
+
+const char* Metrics::STATS_PATH = "/__stats";
+
+int Histogram::BucketOf(uint64_t value) {
+    if(value < static_cast<uint64_t>(SUB)) {
+        return static_cast<int>(value);
+    }
+    // 最高位决定在哪个2的幂区间，接下来的SUB_BITS位决定区间里的哪个桶
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - SUB_BITS;
+    int bucket = (shift + 1) * SUB + static_cast<int>((value >> shift) & (SUB - 1));
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+uint64_t Histogram::UpperOf(int bucket) {
+    if(bucket < SUB) {
+        return bucket;
+    }
+    int shift = bucket / SUB - 1;
+    uint64_t lower = static_cast<uint64_t>(SUB + bucket % SUB) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+void Histogram::Record(uint64_t value) {
+    counts_[BucketOf(value)].fetch_add(1, memory_order_relaxed);
+    sum_.fetch_add(value, memory_order_relaxed);
+}
+
+void Histogram::MergeTo(vector<uint64_t>& counts, uint64_t& sum) const {
+    counts.resize(BUCKETS, 0);
+    for(int i = 0; i < BUCKETS; i++) {
+        counts[i] += counts_[i].load(memory_order_relaxed);
+    }
+    sum += sum_.load(memory_order_relaxed);
+}
+
+Metrics* Metrics::Instance() {
+    static Metrics inst;
+    return &inst;
+}
+
+// 每个线程第一次用到时分配一个分片，之后一直用这个
+Metrics::Shard& Metrics::LocalShard_() {
+    thread_local int idx = nextShard_.fetch_add(1, memory_order_relaxed) % SHARDS;
+    return shards_[idx];
+}
+
+void Metrics::CountStatus(int code) {
+    switch(code) {
+    case 200: Add(STATUS_200); break;
+    case 400: Add(STATUS_400); break;
+    case 403: Add(STATUS_403); break;
+    case 404: Add(STATUS_404); break;
+    default: Add(STATUS_OTHER); break;
+    }
+}
+
+void Metrics::Register(const string& name, const string& type,
+                       const string& help, function<double()> fn) {
+    lock_guard<mutex> locker(mtx_);
+    gauges_.push_back({name, type, help, move(fn)});
+}
+
+// 把所有分片的计数加起来，生成Prometheus文本格式
+string Metrics::Render() {
+    uint64_t counters[COUNTER_NUM] = {0};
+    for(int i = 0; i < SHARDS; i++) {
+        for(int c = 0; c < COUNTER_NUM; c++) {
+            counters[c] += shards_[i].counters[c].load(memory_order_relaxed);
+        }
+    }
+
+    string out;
+    out.reserve(4096);
+    auto counter = [&out](const char* name, const char* help, uint64_t value) {
+        out += string("# HELP ") + name + " " + help + "\n";
+        out += string("# TYPE ") + name + " counter\n";
+        out += string(name) + " " + to_string(value) + "\n";
+    };
+    counter("webserver_accepts_total", "Accepted connections.", counters[ACCEPTS]);
+    counter("webserver_requests_total", "Processed requests.", counters[REQUESTS]);
+    counter("webserver_parse_errors_total", "Requests that failed to parse.", counters[PARSE_ERRORS]);
+    counter("webserver_bytes_in_total", "Bytes read from clients.", counters[BYTES_IN]);
+    counter("webserver_bytes_out_total", "Bytes written to clients.", counters[BYTES_OUT]);
+    counter("webserver_timer_expires_total", "Connections closed by the idle timer.", counters[TIMER_EXPIRES]);
+
+    out += "# HELP webserver_responses_total Responses by status code.\n";
+    out += "# TYPE webserver_responses_total counter\n";
+    const pair<const char*, COUNTER> status[] = {
+        {"200", STATUS_200}, {"400", STATUS_400}, {"403", STATUS_403},
+        {"404", STATUS_404}, {"other", STATUS_OTHER},
+    };
+    for(auto& item: status) {
+        out += string("webserver_responses_total{code=\"") + item.first + "\"} "
+                + to_string(counters[item.second]) + "\n";
+    }
+
+    RenderHistogram_(out, FIRST_BYTE, "webserver_first_byte_seconds",
+                        "Time from accept to the first response byte.");
+    RenderHistogram_(out, REQUEST_TIME, "webserver_request_seconds",
+                        "Time from reading a request to finishing its response.");
+    RenderHistogram_(out, STAGE_QUEUE, "webserver_stage_queue_seconds",
+                        "Time a task waited in the thread pool queue, recorded while tracing.");
+    RenderHistogram_(out, STAGE_READ, "webserver_stage_read_seconds",
+                        "Time spent reading from the socket, recorded while tracing.");
+    RenderHistogram_(out, STAGE_PARSE, "webserver_stage_parse_seconds",
+                        "Time spent parsing a request, recorded while tracing.");
+    RenderHistogram_(out, STAGE_RESPONSE, "webserver_stage_response_seconds",
+                        "Time spent building a response, recorded while tracing.");
+    RenderHistogram_(out, STAGE_WRITE, "webserver_stage_write_seconds",
+                        "Time spent writing to the socket, recorded while tracing.");
+
+    lock_guard<mutex> locker(mtx_);
+    for(auto& g: gauges_) {
+        char value[64];
+        snprintf(value, sizeof(value), "%.17g", g.fn());
+        out += "# HELP " + g.name + " " + g.help + "\n";
+        out += "# TYPE " + g.name + " " + g.type + "\n";
+        out += g.name + " " + value + "\n";
+    }
+    return out;
+}
+
+// 细粒度的桶太多，输出时合并成固定的几个le边界
+void Metrics::RenderHistogram_(string& out, HISTOGRAM h, const char* name, const char* help) {
+    static const uint64_t LE_US[] = {
+        10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000,
+        50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+    };
+    vector<uint64_t> counts;
+    uint64_t sum = 0;
+    for(int i = 0; i < SHARDS; i++) {
+        shards_[i].hists[h].MergeTo(counts, sum);
+    }
+
+    out += string("# HELP ") + name + " " + help + "\n";
+    out += string("# TYPE ") + name + " histogram\n";
+    uint64_t cumulative = 0;
+    int b = 0;
+    char line[128];
+    for(uint64_t le: LE_US) {
+        while(b < Histogram::BUCKETS && Histogram::UpperOf(b) <= le) {
+            cumulative += counts[b++];
+        }
+        snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %lu\n", name, le / 1e6,
+                    static_cast<unsigned long>(cumulative));
+        out += line;
+    }
+    while(b < Histogram::BUCKETS) {
+        cumulative += counts[b++];
+    }
+    snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %lu\n", name, static_cast<unsigned long>(cumulative));
+    out += line;
+    snprintf(line, sizeof(line), "%s_sum %.6f\n", name, sum / 1e6);
+    out += line;
+    snprintf(line, sizeof(line), "%s_count %lu\n", name, static_cast<unsigned long>(cumulative));
+    out += line;
+}
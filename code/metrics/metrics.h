@@ -0,0 +1,119 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-28
+ * @copyleft Apache 2.0
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+#include <time.h>
+
+// HDR风格的对数线性直方图：每个2的幂区间再平均分成SUB个桶，相对误差不超过1/SUB
+// 只有relaxed的原子加，不加锁
+class Histogram {
+public:
+    static const int SUB_BITS = 3;
+    static const int SUB = 1 << SUB_BITS;    // 每个2的幂区间分成的桶数
+    static const int BUCKETS = SUB * 30;     // 最大能表示约2^31，单位微秒的话大约35分钟
+
+    void Record(uint64_t value);  // 记录一个值
+    void MergeTo(std::vector<uint64_t>& counts, uint64_t& sum) const;  // 累加到counts里，生成统计时用
+
+    static int BucketOf(uint64_t value);  // 值对应的桶
+    static uint64_t UpperOf(int bucket);  // 桶的上界(包含)
+
+private:
+    std::atomic<uint64_t> counts_[BUCKETS] = {};
+    std::atomic<uint64_t> sum_{0};
+};
+
+// 进程级的统计，按线程分片，每个线程写自己的分片(按cache line对齐)，
+// 生成统计的时候再把所有分片加起来，热路径上没有锁也没有伪共享
+class Metrics {
+public:
+    enum COUNTER {
+        ACCEPTS = 0,    // 接入的连接数
+        REQUESTS,       // 处理的请求数
+        PARSE_ERRORS,   // 解析失败的请求数
+        BYTES_IN,       // 读到的字节数
+        BYTES_OUT,      // 写出的字节数
+        TIMER_EXPIRES,  // 超时关闭的连接数
+        STATUS_200,     // 各个响应状态码的数量
+        STATUS_400,
+        STATUS_403,
+        STATUS_404,
+        STATUS_OTHER,
+        COUNTER_NUM,
+    };
+
+    enum HISTOGRAM {
+        FIRST_BYTE = 0, // 从accept到写出响应第一个字节，单位微秒
+        REQUEST_TIME,   // 从读到请求到响应全部写完，单位微秒
+        STAGE_QUEUE,    // 各个处理阶段的耗时，单位微秒，只在打开trace时记录，顺序和Trace::STAGE一样
+        STAGE_READ,
+        STAGE_PARSE,
+        STAGE_RESPONSE,
+        STAGE_WRITE,
+        HISTOGRAM_NUM,
+    };
+
+    static Metrics* Instance();
+
+    static void Add(COUNTER c, uint64_t n = 1) {
+        Instance()->LocalShard_().counters[c].fetch_add(n, std::memory_order_relaxed);
+    }
+    static void Observe(HISTOGRAM h, uint64_t us) {
+        Instance()->LocalShard_().hists[h].Record(us);
+    }
+    static void CountStatus(int code);  // 按状态码计数
+
+    // 单调时钟，单位微秒
+    static uint64_t NowUs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+    }
+
+    // 注册一个在生成统计时才去读取的值，比如线程池队列长度，type是gauge或者counter
+    void Register(const std::string& name, const std::string& type,
+                  const std::string& help, std::function<double()> fn);
+
+    // 生成Prometheus文本格式的统计
+    std::string Render();
+
+    static const char* STATS_PATH;  // 保留的统计路径
+
+private:
+    Metrics() = default;
+
+    static const int SHARDS = 64;  // 分片数，线程数超过时会有几个线程共用一个分片
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counters[COUNTER_NUM] = {};
+        Histogram hists[HISTOGRAM_NUM];
+    };
+
+    struct Gauge {
+        std::string name;
+        std::string type;
+        std::string help;
+        std::function<double()> fn;
+    };
+
+    Shard& LocalShard_();
+    void RenderHistogram_(std::string& out, HISTOGRAM h, const char* name, const char* help);
+
+    Shard shards_[SHARDS];
+    std::atomic<int> nextShard_{0};
+
+    std::mutex mtx_;    // 只保护gauges_，热路径不会用到
+    std::vector<Gauge> gauges_;
+};
+
+#endif //METRICS_H
@@ -0,0 +1,90 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-28
+ * @copyleft Apache 2.0
+ */
+#include "trace.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "metrics.h"
+
+using namespace std;
+
+const char* Trace::TRACE_PATH = "/__trace";
+
+namespace {
+
+const char* STAGE_NAME[Trace::STAGE_NUM] = { "queue", "read", "parse", "response", "write" };
+
+} // namespace
+
+Trace* Trace::Instance() {
+    static Trace inst;
+    return &inst;
+}
+
+void Trace::SetEnabled(bool on) {
+    enabled_.store(on, memory_order_relaxed);
+}
+
+// 线程第一次记录时注册，线程池的线程一直活着，不回收
+Trace::Ring* Trace::LocalRing_() {
+    thread_local Ring* ring = nullptr;
+    if(!ring) {
+        lock_guard<mutex> locker(mtx_);
+        rings_.emplace_back(new Ring);
+        ring = rings_.back().get();
+        ring->tid = static_cast<int>(syscall(SYS_gettid));
+    }
+    return ring;
+}
+
+void Trace::Record(STAGE stage, int fd, uint64_t startNs, uint64_t endNs) {
+    uint64_t durNs = endNs > startNs ? endNs - startNs : 0;
+    Metrics::Observe(static_cast<Metrics::HISTOGRAM>(Metrics::STAGE_QUEUE + stage), durNs / 1000);
+    Ring* ring = Instance()->LocalRing_();
+    lock_guard<mutex> locker(ring->mtx);
+    Event& ev = ring->events[ring->head++ & (RING_SIZE - 1)];
+    ev.startNs = startNs;
+    ev.durNs = durNs;
+    ev.fd = fd;
+    ev.stage = stage;
+}
+
+// {"traceEvents":[{"name":"parse","ph":"X","ts":微秒,"dur":微秒,"pid":..,"tid":..,"args":{"fd":..}},...]}
+string Trace::RenderChrome() {
+    vector<Ring*> rings;
+    {
+        lock_guard<mutex> locker(mtx_);
+        for(auto& ring: rings_) { rings.push_back(ring.get()); }
+    }
+    int pid = getpid();
+    string out = "{\"traceEvents\":[";
+    vector<Event> events;
+    char line[192];
+    bool first = true;
+    for(Ring* ring: rings) {
+        {
+            // 先拷出来再格式化，不让写的线程等太久
+            lock_guard<mutex> locker(ring->mtx);
+            uint64_t cnt = ring->head < RING_SIZE ? ring->head : RING_SIZE;
+            events.clear();
+            for(uint64_t i = ring->head - cnt; i < ring->head; i++) {
+                events.push_back(ring->events[i & (RING_SIZE - 1)]);
+            }
+        }
+        out.reserve(out.size() + events.size() * 128);
+        for(const Event& ev: events) {
+            int n = snprintf(line, sizeof(line),
+                    "%s{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"fd\":%d}}",
+                    first ? "" : ",\n", STAGE_NAME[ev.stage], ev.startNs / 1000.0, ev.durNs / 1000.0,
+                    pid, ring->tid, ev.fd);
+            out.append(line, n);
+            first = false;
+        }
+    }
+    out += "],\"displayTimeUnit\":\"ns\"}\n";
+    return out;
+}
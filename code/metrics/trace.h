@@ -0,0 +1,92 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-28
+ * @copyleft Apache 2.0
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <time.h>
+
+// 按阶段记录请求的耗时，用来查线上的卡顿到底花在哪一步，不用挂profiler
+// 打开时每个线程把事件写进自己的环形缓冲区，只保留最近的RING_SIZE个，
+// 可以从/__trace导出成Chrome trace的json(用chrome://tracing或者Perfetto打开)，
+// 同时按阶段汇总进/__stats的直方图。关闭时每个埋点只多一次relaxed的原子读
+class Trace {
+public:
+    enum STAGE {
+        QUEUE = 0,  // 在线程池队列里等的时间
+        READ,       // 从套接字读请求
+        PARSE,      // 解析请求
+        RESPONSE,   // 生成响应，包括stat和打开文件
+        WRITE,      // 写响应
+        STAGE_NUM,
+    };
+
+    static Trace* Instance();
+
+    static bool Enabled() { return Instance()->enabled_.load(std::memory_order_relaxed); }
+    void SetEnabled(bool on);   // 运行时开关，关掉时已经记下的事件还留着
+
+    // 单调时钟，单位纳秒
+    static uint64_t NowNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // 记一个阶段，fd用来在trace里区分连接
+    static void Record(STAGE stage, int fd, uint64_t startNs, uint64_t endNs);
+
+    // 所有线程的环形缓冲区导出成Chrome trace格式
+    std::string RenderChrome();
+
+    static const char* TRACE_PATH;  // 保留的导出路径
+
+    // 作用域内的耗时记成一个阶段，没打开时什么也不做
+    class Span {
+    public:
+        Span(STAGE stage, int fd): stage_(stage), fd_(fd), startNs_(Enabled() ? NowNs() : 0) {}
+        ~Span() {
+            if(startNs_) { Record(stage_, fd_, startNs_, NowNs()); }
+        }
+    private:
+        STAGE stage_;
+        int fd_;
+        uint64_t startNs_;
+    };
+
+private:
+    Trace() = default;
+
+    static const size_t RING_SIZE = 4096;  // 每个线程保留的事件数，要是2的幂
+
+    struct Event {
+        uint64_t startNs;
+        uint64_t durNs;
+        int fd;
+        int stage;
+    };
+
+    // 每个线程一个，只有本线程写，导出时才会有别的线程来锁，几乎没有竞争
+    struct Ring {
+        std::mutex mtx;
+        int tid;
+        uint64_t head = 0;      // 一共写过多少个事件
+        Event events[RING_SIZE];
+    };
+
+    Ring* LocalRing_();
+
+    std::atomic<bool> enabled_{false};
+    std::mutex mtx_;    // 保护rings_
+    std::vector<std::unique_ptr<Ring>> rings_;
+};
+
+#endif //TRACE_H
@@ -0,0 +1,83 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-15
+ * @copyleft Apache 2.0
+ */ 
+#include "affinity.h"
+
+#include <sched.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+bool CpuAffinity::ParseCpuList(const string& spec, vector<int>* cpus) {
+    cpus->clear();
+    size_t pos = 0;
+    while(pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if(end == string::npos) { end = spec.size(); }
+        string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        if(item.empty()) { return false; }
+
+        char* next = nullptr;
+        long first = strtol(item.c_str(), &next, 10);
+        long last = first;
+        if(next == item.c_str() || first < 0) { return false; }
+        if(*next == '-') {
+            const char* begin = next + 1;
+            last = strtol(begin, &next, 10);
+            if(next == begin || last < first) { return false; }
+        }
+        if(*next != '\0' || last >= CPU_SETSIZE) { return false; }
+        for(long cpu = first; cpu <= last; cpu++) {
+            cpus->push_back(static_cast<int>(cpu));
+        }
+    }
+    return true;
+}
+
+bool CpuAffinity::Allowed(int cpu) {
+    if(cpu < 0 || cpu >= CPU_SETSIZE) { return false; }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) < 0) { return false; }
+    return CPU_ISSET(cpu, &set);
+}
+
+bool CpuAffinity::Pin(pthread_t thread, const vector<int>& cpus) {
+    if(cpus.empty()) { return true; }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu: cpus) { CPU_SET(cpu, &set); }
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+int CpuAffinity::NodeOfCpu(int cpu) {
+    // /sys/devices/system/cpu/cpuN/ 下面有一个nodeM的链接
+    string path = "/sys/devices/system/cpu/cpu" + to_string(cpu);
+    DIR* dir = opendir(path.c_str());
+    if(!dir) { return -1; }
+    int node = -1;
+    while(dirent* entry = readdir(dir)) {
+        if(strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+bool CpuAffinity::PreferNode(int node) {
+    if(node < 0) { return true; }
+    const unsigned long BITS = sizeof(unsigned long) * 8;
+    if(node >= static_cast<int>(BITS)) { return false; }
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED_, &mask, BITS) == 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-15
+ * @copyleft Apache 2.0
+ */ 
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+// 线程绑核和NUMA内存策略
+// 事件循环、工作线程和日志写线程默认由调度器随意迁移，跨socket迁移后连接的状态就不在本地缓存里了，
+// 绑核后可以让它们固定在指定的CPU上，内存也优先从这些CPU所在的NUMA节点上分配
+class CpuAffinity {
+public:
+    // 解析CPU列表，格式和taskset一样，比如 "0-3,8,10-11"，空串得到空列表
+    static bool ParseCpuList(const std::string& spec, std::vector<int>* cpus);
+
+    // 当前进程是否允许运行在这个CPU上(受taskset/cgroup限制)
+    static bool Allowed(int cpu);
+
+    // 把线程绑定到一组CPU上，cpus为空时什么也不做
+    static bool Pin(pthread_t thread, const std::vector<int>& cpus);
+    static bool PinSelf(const std::vector<int>& cpus) { return Pin(pthread_self(), cpus); }
+
+    // CPU所在的NUMA节点，从/sys里读，没有NUMA信息时返回-1
+    static int NodeOfCpu(int cpu);
+
+    // 当前线程之后分配的内存优先放在node上，node为-1时什么也不做
+    static bool PreferNode(int node);
+
+private:
+    static const int MPOL_PREFERRED_ = 1;   // linux/mempolicy.h，避免依赖libnuma
+};
+
+#endif //AFFINITY_H
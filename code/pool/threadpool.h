@@ -12,16 +12,28 @@
 #include <queue>
 #include <thread>
 #include <functional>
+#include <atomic>
+#include <vector>
+#include <assert.h>
+#include "affinity.h"
 class ThreadPool {
 public:
     // 防止构造函数会隐式转换
-    explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()) {
+    // cpus不为空时第i个线程绑定到cpus[i % cpus.size()]上，numaLocal表示内存优先从这个CPU所在的节点分配
+    explicit ThreadPool(size_t threadCount = 8, const std::vector<int>& cpus = {}, bool numaLocal = false):
+            pool_(std::make_shared<Pool>()) {
             assert(threadCount > 0);
 
             // 创建threadCount个子线程
             for(size_t i = 0; i < threadCount; i++) {
+                int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
                 // 传递的是一个lambam表达式，pool是一个临时变量使表达式里面可以使用pool_相当于函数传参了
-                std::thread([pool = pool_] {  // 相当于创建了threadCount个pool指针，但是指向都是pool_也就是类似指针的值传递
+                threads_.emplace_back([pool = pool_, cpu, numaLocal] {  // 相当于创建了threadCount个pool指针，但是指向都是pool_也就是类似指针的值传递
+                    // 先绑核再分配内存，任务里分配的缓冲区才会落在本地节点上
+                    if(cpu >= 0) {
+                        CpuAffinity::PinSelf({ cpu });
+                        if(numaLocal) { CpuAffinity::PreferNode(CpuAffinity::NodeOfCpu(cpu)); }
+                    }
                     // unique_lock使用了RAII技术，在构造函数就枷锁了,析构函数才解锁，确保工作队列的取出使互斥的
                     std::unique_lock<std::mutex> locker(pool->mtx);
                     while(true) {
@@ -30,6 +42,7 @@ public:
                             auto task = std::move(pool->tasks.front());
                             // 移除掉
                             pool->tasks.pop();
+                            pool->pending.fetch_sub(1, std::memory_order_relaxed);
                             // 解锁开始执行任务
                             locker.unlock();
                             task();
@@ -44,7 +57,7 @@ public:
                             pool->cond.wait(locker);
                         }    
                     }
-                }).detach(); // 线程分离
+                }); // 析构的时候join，保证退出前队列里的任务都执行完
             }
     }
 
@@ -62,6 +75,10 @@ public:
             // 唤醒所有线程关闭线程,让线程走到break那里去退出
             pool_->cond.notify_all();
         }
+        // 等待子线程把剩下的任务做完再退出，避免进程退出时还有线程在访问连接
+        for(auto& t: threads_) {
+            if(t.joinable()) { t.join(); }
+        }
     }
 
     // 完美转发
@@ -72,11 +89,17 @@ public:
             std::lock_guard<std::mutex> locker(pool_->mtx);
             // 添加任务队列
             pool_->tasks.emplace(std::forward<F>(task));
+            pool_->pending.fetch_add(1, std::memory_order_relaxed);
         }
         // 唤醒一个睡眠的线程,表示当前有了新的工作队列
         pool_->cond.notify_one();
     }
 
+    // 排队等待执行的任务数，不加锁，只是一个近似值，用于过载判断
+    size_t QueueSize() const {
+        return pool_ ? pool_->pending.load(std::memory_order_relaxed) : 0;
+    }
+
 private:
     // 结构体, 池子
     struct Pool {
@@ -88,9 +111,13 @@ private:
         bool isClosed;
         // 队列（保存的是任务）
         std::queue<std::function<void()>> tasks;
+        // 队列长度，和tasks同步更新，读的时候不需要加锁
+        std::atomic<size_t> pending{0};
     };
     // 线程池
     std::shared_ptr<Pool> pool_;
+    // 工作线程
+    std::vector<std::thread> threads_;
 };
 
 
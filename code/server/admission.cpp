@@ -0,0 +1,66 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "admission.h"
+
+// 预先生成好的503响应，拒绝连接时不用再拼接字符串
+#define BUSY_BODY "<html><title>Error</title><body bgcolor=\"ffffff\">" \
+                  "503 : Service Unavailable\n<p>Server busy!</p>" \
+                  "<hr><em>TinyWebServer</em></body></html>"
+static const char BUSY_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Connection: close\r\n"
+    "Retry-After: 1\r\n"
+    "Content-type: text/html\r\n"
+    "Content-length: 134\r\n\r\n"
+    BUSY_BODY;
+static_assert(sizeof(BUSY_BODY) - 1 == 134, "Content-length of BUSY_BODY");
+
+bool AdmissionControl::Overloaded(size_t queueDepth, int inflight, int loopLagMs) const {
+    if(limits_.maxQueue > 0 && queueDepth >= limits_.maxQueue) { return true; }
+    if(limits_.maxInflight > 0 && inflight >= limits_.maxInflight) { return true; }
+    if(limits_.maxLoopLagMs > 0 && loopLagMs >= limits_.maxLoopLagMs) { return true; }
+    return false;
+}
+
+AdmissionControl::DECISION AdmissionControl::Admit(uint64_t ip, int userCount, int maxUser,
+                    size_t queueDepth, int inflight, int loopLagMs) {
+    if(userCount >= maxUser) {
+        stats_.rejectFull.fetch_add(1, std::memory_order_relaxed);
+        return REJECT_FULL;
+    }
+    if(Overloaded(queueDepth, inflight, loopLagMs)) {
+        stats_.rejectOverload.fetch_add(1, std::memory_order_relaxed);
+        return REJECT_OVERLOAD;
+    }
+    if(limits_.maxConnPerIp > 0) {
+        std::lock_guard<std::mutex> locker(mtx_);
+        int& cnt = ipCount_[ip];
+        if(cnt >= limits_.maxConnPerIp) {
+            stats_.rejectPerIp.fetch_add(1, std::memory_order_relaxed);
+            return REJECT_PER_IP;
+        }
+        cnt++;
+    }
+    stats_.admitted.fetch_add(1, std::memory_order_relaxed);
+    return ADMIT;
+}
+
+void AdmissionControl::Release(uint64_t ip) {
+    if(limits_.maxConnPerIp <= 0) { return; }
+    std::lock_guard<std::mutex> locker(mtx_);
+    auto it = ipCount_.find(ip);
+    if(it == ipCount_.end()) { return; }
+    // 计数归零就删掉，避免表无限增长
+    if(--it->second <= 0) {
+        ipCount_.erase(it);
+    }
+}
+
+void AdmissionControl::SendBusy(int fd) {
+    // 新连接的发送缓冲区是空的，一次send就能发完，不会阻塞主线程
+    send(fd, BUSY_RESPONSE, sizeof(BUSY_RESPONSE) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+}
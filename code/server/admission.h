@@ -0,0 +1,85 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+#include <sys/socket.h>  // send()
+#include <unistd.h>      // close()
+
+// 连接级别的过载保护：根据线程池队列深度、正在处理的请求数、事件循环延迟
+// 以及单个客户端ip的连接数决定新连接是否接入
+class AdmissionControl {
+public:
+    // 超过水位线时的处理方式
+    enum OVERLOAD_MODE {
+        SHED = 0,   // 回复预先生成好的503后直接关闭
+        PAUSE,      // 暂停accept，等负载降下来再恢复监听
+    };
+
+    // 各项阈值，0表示不限制
+    struct Limits {
+        size_t maxQueue = 10000;    // 线程池中排队的任务数
+        int maxInflight = 0;        // 已分发到线程池还没处理完的请求数
+        int maxLoopLagMs = 500;     // 事件循环处理一轮事件的耗时
+        int maxConnPerIp = 0;       // 单个ip的连接数
+        OVERLOAD_MODE mode = SHED;
+    };
+
+    // 判断结果
+    enum DECISION {
+        ADMIT = 0,      // 接入
+        REJECT_FULL,    // 文件描述符用完了
+        REJECT_PER_IP,  // 单个ip连接数超过限制
+        REJECT_OVERLOAD,// 服务器过载
+    };
+
+    // 计数器，只增不减，都是relaxed的原子操作
+    struct Stats {
+        std::atomic<uint64_t> admitted{0};      // 接入的连接数
+        std::atomic<uint64_t> rejectFull{0};    // 因为连接数达到MAX_FD被拒绝的
+        std::atomic<uint64_t> rejectPerIp{0};   // 因为单ip连接数限制被拒绝的
+        std::atomic<uint64_t> rejectOverload{0};// 因为过载被拒绝的
+        std::atomic<uint64_t> pauses{0};        // 暂停accept的次数
+    };
+
+    AdmissionControl() = default;
+    explicit AdmissionControl(const Limits& limits): limits_(limits) {}
+
+    void SetLimits(const Limits& limits) { limits_ = limits; }
+    const Limits& GetLimits() const { return limits_; }
+
+    // 当前负载是否超过水位线，在主线程调用
+    bool Overloaded(size_t queueDepth, int inflight, int loopLagMs) const;
+
+    // 新连接到来时判断是否接入，接入时会占用该ip的一个名额
+    // ip是PeerAddr::Key()，IPv6按/64前缀算一个ip
+    DECISION Admit(uint64_t ip, int userCount, int maxUser,
+                   size_t queueDepth, int inflight, int loopLagMs);
+
+    // 连接关闭时释放该ip的名额，可能在子线程中调用
+    void Release(uint64_t ip);
+
+    // 记录一次暂停accept
+    void OnPause() { stats_.pauses.fetch_add(1, std::memory_order_relaxed); }
+
+    const Stats& GetStats() const { return stats_; }
+
+    // 非阻塞地发送预先生成好的503响应并关闭fd
+    static void SendBusy(int fd);
+
+private:
+    Limits limits_;
+    Stats stats_;
+
+    std::mutex mtx_;    // 保护ipCount_
+    std::unordered_map<uint64_t, int> ipCount_;    // ip - 连接数
+};
+
+#endif //ADMISSION_H
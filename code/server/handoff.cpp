@@ -0,0 +1,96 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "handoff.h"
+
+bool ListenHandoff::FillAddr_(const char* path, sockaddr_un& addr) {
+    if(!path || strlen(path) >= sizeof(addr.sun_path)) { return false; }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+int ListenHandoff::CreateServer(const char* path) {
+    sockaddr_un addr;
+    if(!FillAddr_(path, addr)) { return -1; }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) { return -1; }
+    // 可能是上一个进程留下的，或者是刚把监听fd交给我们的旧进程的
+    unlink(path);
+    if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+std::vector<int> ListenHandoff::Takeover(const char* path) {
+    sockaddr_un addr;
+    if(!FillAddr_(path, addr)) { return {}; }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) { return {}; }
+    // 没有旧进程在监听时connect会直接失败
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return {};
+    }
+    std::vector<int> fds = RecvFds_(fd);
+    close(fd);
+    return fds;
+}
+
+bool ListenHandoff::SendFds(int sock, const std::vector<int>& fds) {
+    if(fds.empty() || fds.size() > MAX_FDS) { return false; }
+    char data = 'F';
+    iovec iov = { &data, 1 };
+    char ctrl[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    memset(ctrl, 0, sizeof(ctrl));
+
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    ssize_t ret;
+    do {
+        ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while(ret < 0 && errno == EINTR);
+    return ret == 1;
+}
+
+std::vector<int> ListenHandoff::RecvFds_(int sock) {
+    char data;
+    iovec iov = { &data, 1 };
+    char ctrl[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    ssize_t ret;
+    do {
+        ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while(ret < 0 && errno == EINTR);
+
+    std::vector<int> fds;
+    if(ret <= 0) { return fds; }
+    for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) { continue; }
+        size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        fds.resize(n);
+        memcpy(fds.data(), CMSG_DATA(cmsg), sizeof(int) * n);
+    }
+    return fds;
+}
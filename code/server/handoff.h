@@ -0,0 +1,36 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <vector>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>      // close()
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// 通过Unix域套接字(SCM_RIGHTS)在新旧进程之间传递监听套接字，实现不停机重启：
+// 旧进程在控制套接字上等待，新进程连上来后把监听fd发过去，然后旧进程停止accept并排空连接
+class ListenHandoff {
+public:
+    // 旧进程：在path上创建控制套接字，返回监听的fd，失败返回-1
+    static int CreateServer(const char* path);
+
+    // 新进程：连接path上的旧进程，接收监听fd，没有旧进程或者失败时返回空
+    static std::vector<int> Takeover(const char* path);
+
+    // 通过已连接的Unix套接字发送一组fd
+    static bool SendFds(int sock, const std::vector<int>& fds);
+
+private:
+    static std::vector<int> RecvFds_(int sock);
+    static bool FillAddr_(const char* path, sockaddr_un& addr);
+
+    static const int MAX_FDS = 16;  // 一次最多传递的fd个数
+};
+
+#endif //HANDOFF_H
@@ -0,0 +1,148 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "listenaddr.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+namespace {
+
+bool ParsePort(const string& str, int* port) {
+    char* end = nullptr;
+    errno = 0;
+    long val = strtol(str.c_str(), &end, 10);
+    if(str.empty() || *end != '\0' || errno == ERANGE || val < 1 || val > 65535) {
+        return false;
+    }
+    *port = static_cast<int>(val);
+    return true;
+}
+
+string Trim(const string& str) {
+    size_t begin = str.find_first_not_of(" \t");
+    if(begin == string::npos) { return ""; }
+    size_t end = str.find_last_not_of(" \t");
+    return str.substr(begin, end - begin + 1);
+}
+
+} // namespace
+
+int ListenAddr::Port() const {
+    if(addr.ss_family == AF_INET6) {
+        return ntohs(reinterpret_cast<const sockaddr_in6*>(&addr)->sin6_port);
+    }
+    return ntohs(reinterpret_cast<const sockaddr_in*>(&addr)->sin_port);
+}
+
+bool ListenAddr::BoundTo(int fd) const {
+    sockaddr_storage local;
+    socklen_t localLen = sizeof(local);
+    if(getsockname(fd, reinterpret_cast<sockaddr*>(&local), &localLen) < 0) { return false; }
+    if(local.ss_family != addr.ss_family) { return false; }
+    if(addr.ss_family == AF_INET6) {
+        const sockaddr_in6* a = reinterpret_cast<const sockaddr_in6*>(&addr);
+        const sockaddr_in6* b = reinterpret_cast<const sockaddr_in6*>(&local);
+        return a->sin6_port == b->sin6_port &&
+               memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+    }
+    const sockaddr_in* a = reinterpret_cast<const sockaddr_in*>(&addr);
+    const sockaddr_in* b = reinterpret_cast<const sockaddr_in*>(&local);
+    return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+}
+
+bool ListenAddr::Parse(const string& item, int defaultPort, ListenAddr* out, string* err) {
+    string host = item;
+    int port = defaultPort;
+    bool v6 = false;
+    if(!item.empty() && item[0] == '[') {
+        // [v6]或者[v6]:port
+        size_t bracket = item.find(']');
+        if(bracket == string::npos) {
+            *err = "listen: missing ']' in " + item;
+            return false;
+        }
+        host = item.substr(1, bracket - 1);
+        if(bracket + 1 < item.size()) {
+            if(item[bracket + 1] != ':' || !ParsePort(item.substr(bracket + 2), &port)) {
+                *err = "listen: bad port in " + item;
+                return false;
+            }
+        }
+        v6 = true;
+    } else if(item.find(':') != item.rfind(':')) {
+        // 不带方括号的v6地址，不能写端口
+        v6 = true;
+    } else {
+        size_t colon = item.find(':');
+        if(colon != string::npos) {
+            host = item.substr(0, colon);
+            if(!ParsePort(item.substr(colon + 1), &port)) {
+                *err = "listen: bad port in " + item;
+                return false;
+            }
+        }
+        if(host.empty() || host == "*") { host = "0.0.0.0"; }
+    }
+
+    memset(&out->addr, 0, sizeof(out->addr));
+    if(v6) {
+        sockaddr_in6* addr6 = reinterpret_cast<sockaddr_in6*>(&out->addr);
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(port);
+        if(inet_pton(AF_INET6, host.c_str(), &addr6->sin6_addr) != 1) {
+            *err = "listen: bad IPv6 address " + item;
+            return false;
+        }
+        char buf[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, &addr6->sin6_addr, buf, sizeof(buf));
+        out->len = sizeof(sockaddr_in6);
+        out->text = "[" + string(buf) + "]:" + to_string(port);
+    } else {
+        sockaddr_in* addr4 = reinterpret_cast<sockaddr_in*>(&out->addr);
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(port);
+        if(inet_pton(AF_INET, host.c_str(), &addr4->sin_addr) != 1) {
+            *err = "listen: bad IPv4 address " + item;
+            return false;
+        }
+        char buf[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr4->sin_addr, buf, sizeof(buf));
+        out->len = sizeof(sockaddr_in);
+        out->text = string(buf) + ":" + to_string(port);
+    }
+    return true;
+}
+
+bool ListenAddr::ParseList(const string& spec, int defaultPort, vector<ListenAddr>* out, string* err) {
+    out->clear();
+    string list = Trim(spec);
+    if(list.empty()) { list = "0.0.0.0"; }
+    size_t begin = 0;
+    while(begin <= list.size()) {
+        size_t comma = list.find(',', begin);
+        if(comma == string::npos) { comma = list.size(); }
+        string item = Trim(list.substr(begin, comma - begin));
+        if(item.empty()) {
+            *err = "listen: empty address in " + spec;
+            return false;
+        }
+        ListenAddr addr;
+        if(!Parse(item, defaultPort, &addr, err)) { return false; }
+        for(auto& other: *out) {
+            if(other.text == addr.text) {
+                *err = "listen: duplicate address " + addr.text;
+                return false;
+            }
+        }
+        out->push_back(addr);
+        begin = comma + 1;
+    }
+    return true;
+}
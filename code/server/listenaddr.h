@@ -0,0 +1,36 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef LISTEN_ADDR_H
+#define LISTEN_ADDR_H
+
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// 一个监听地址，配置里的listen是逗号分隔的列表，每一项是下面几种写法：
+//   0.0.0.0  127.0.0.1:8080  :8080  *     IPv4，没写端口用port
+//   [::]  [::1]:8080  ::                  IPv6，带端口时地址要加方括号
+// 只接受数字地址，不做域名解析
+struct ListenAddr {
+    sockaddr_storage addr;
+    socklen_t len;
+    std::string text;   // 规范化以后的写法，打日志用
+
+    int Family() const { return addr.ss_family; }
+    int Port() const;
+
+    // fd是不是绑在这个地址上，接管监听套接字时用来对应
+    bool BoundTo(int fd) const;
+
+    // 解析一项
+    static bool Parse(const std::string& item, int defaultPort, ListenAddr* out, std::string* err);
+    // 解析整个列表，为空表示0.0.0.0:defaultPort
+    static bool ParseList(const std::string& spec, int defaultPort, std::vector<ListenAddr>* out,
+                          std::string* err);
+};
+
+#endif //LISTEN_ADDR_H
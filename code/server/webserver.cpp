@@ -8,53 +8,240 @@
 
 using namespace std;
 
-WebServer::WebServer(
-            int port, int trigMode, int timeoutMS, bool OptLinger,
-            int sqlPort, const char* sqlUser, const  char* sqlPwd,
-            const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
-            port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller()){
-    //  获取当前的工作路径 就是pwd
-    srcDir_ = getcwd(nullptr, 256);
-    assert(srcDir_);
-    // /home/gdw/WebServer-master/resources/  拼接服务器资源的路径
-    strncat(srcDir_, "/resources/", 16);
+int WebServer::sigPipe_[2] = { -1, -1 };
+
+WebServer::WebServer(const Config& config):
+            config_(config), port_(config.port), openLinger_(config.optLinger),
+            timeoutMS_(config.timeoutMs), isClose_(false),
+            acceptPaused_(false), loopLagMs_(0), inflight_(0),
+            draining_(false), handoffPath_(config.handoffPath),
+            takeover_(config.takeover), handoffFd_(-1), cacheFd_(-1),
+            timer_(new HeapTimer()), threadpool_(new ThreadPool(config.threadNum, CpuList_(config.workerCpus), config.numaLocal)), epoller_(new Epoller()),
+            admission_(AdmissionLimits_(config)) {
+    if(config_.srcDir.empty()) {
+        //  获取当前的工作路径 就是pwd
+        char* cwd = getcwd(nullptr, 0);
+        assert(cwd);
+        // /home/gdw/WebServer-master/resources/  拼接服务器资源的路径
+        srcDir_ = string(cwd) + "/resources/";
+        free(cwd);
+    } else {
+        srcDir_ = config_.srcDir;
+        if(srcDir_.back() != '/') { srcDir_ += '/'; }
+    }
 
     HttpConn::userCount = 0;
-    HttpConn::srcDir = srcDir_;
-    SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
+    HttpConn::srcDir = srcDir_.c_str();
+    HttpConn::bufferSize = config_.bufferSize;
+    HttpConn::bufferMax = config_.bufferMax;
+    HttpConn::msgMore = config_.coalesce == "more";
+    HttpConn::tcpCork = config_.coalesce == "cork";
+    HttpConn::adminAccess = AdminAccess_(config_.adminAccess);
+    if(config_.sqlStub) {
+        HttpRequest::SetVerifier(HttpRequest::MemoryVerify);
+    } else {
+        SqlConnPool::Instance()->Init(config_.sqlHost.c_str(), config_.sqlPort, config_.sqlUser.c_str(),
+                                      config_.sqlPwd.c_str(), config_.dbName.c_str(), config_.connPoolNum);
+    }
 
     // 初始化事件的模式
-    InitEventMode_(trigMode);
+    InitEventMode_(config_.trigMode);
+
+    // 生成统计时才去读取的值
+    RegisterMetrics_();
+
+    if(config_.openLog) {
+        // logQueSize为0表示用同步，不用异步，先初始化日志，套接字初始化出错时才有记录
+        Log::Instance()->init(config_.logLevel, config_.logDir.c_str(), ".log", config_.logQueSize,
+                              static_cast<long long>(config_.logMaxMb) * 1024 * 1024, config_.logCompress,
+                              LogOverflow_(config_.logOverflow));
+    }
+    if(!InitAccessLog_()) { isClose_ = true; }
+    Trace::Instance()->SetEnabled(config_.trace);
 
     // 初始化套接字
     if(!InitSocket_()) { isClose_ = true;}
+    if(!isClose_ && !InitSignal_()) { isClose_ = true; }
+    if(!isClose_ && !InitHandoff_()) { isClose_ = true; }
+    if(!isClose_ && !InitFileCache_()) { isClose_ = true; }
+    if(!isClose_ && !InitPreload_()) { isClose_ = true; }
+    // 工作线程和日志写线程都已经创建好了，再绑主线程，新线程不会继承主线程的绑定
+    if(!isClose_ && !InitAffinity_()) { isClose_ = true; }
 
-    if(openLog) {
-        // logQueSize为0表示用同步，不用异步
-        Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
+    if(config_.openLog) {
         if(isClose_) { LOG_ERROR("========== Server init error!=========="); }
         else {
             LOG_INFO("========== Server init ==========");
-            LOG_INFO("Port:%d, OpenLinger: %s", port_, OptLinger? "true":"false");
+            LOG_INFO("Port:%d, OpenLinger: %s, Backlog: %d", port_, openLinger_? "true":"false", config_.backlog);
+            LOG_INFO("TcpNoDelay: %s, Coalesce: %s, DeferAccept: %ds, FastOpen: %d, SndBuf: %d, RcvBuf: %d",
+                            config_.tcpNoDelay ? "true" : "false", config_.coalesce.c_str(),
+                            config_.deferAcceptSec, config_.fastOpen, config_.sndBuf, config_.rcvBuf);
             LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
-            LOG_INFO("LogSys level: %d", logLevel);
+            LOG_INFO("LogSys level: %d, maxMb: %d, compress: %s, overflow: %s", config_.logLevel,
+                            config_.logMaxMb, config_.logCompress ? "true" : "false", config_.logOverflow.c_str());
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("FileCache size: %d, inotify: %s, revalidate: %dms", config_.fileCache,
+                            cacheFd_ >= 0 ? "true" : "false", FileCache::Instance()->RevalidateMs());
+            LOG_INFO("Preload: %s, maxMb: %d, maxFileKb: %d", config_.preload ? "true" : "false",
+                            config_.preloadMaxMb, config_.preloadMaxFileKb);
+            LOG_INFO("SqlConnPool num: %d, stub: %s, ThreadPool num: %d", config_.connPoolNum,
+                            config_.sqlStub ? "true" : "false", config_.threadNum);
+            const AdmissionControl::Limits& limits = admission_.GetLimits();
+            LOG_INFO("Handoff path: %s, takeover: %s", handoffPath_.empty() ? "none" : handoffPath_.c_str(),
+                            takeover_ ? "true" : "false");
+            LOG_INFO("Admission maxQueue: %zu, maxInflight: %d, maxLoopLag: %dms, maxConnPerIp: %d, mode: %s",
+                            limits.maxQueue, limits.maxInflight, limits.maxLoopLagMs, limits.maxConnPerIp,
+                            limits.mode == AdmissionControl::PAUSE ? "pause" : "shed");
+            config_.Dump();
         }
     }
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
+    // 先等子线程把手上的任务做完，再释放连接和其他资源
+    threadpool_.reset();
+    for(int fd: listenFds_) { close(fd); }
+    if(handoffFd_ >= 0) {
+        close(handoffFd_);
+        unlink(handoffPath_.c_str());
+    }
     isClose_ = true;
-    free(srcDir_);
+    // 工作线程都停了，把访问日志剩下的写完
+    AccessLog::Instance()->Close();
+    ImageBuilder::Instance()->Stop();
+    FileCache::Instance()->Close();
     SqlConnPool::Instance()->ClosePool();
 }
 
+HttpConn::ADMIN_ACCESS WebServer::AdminAccess_(const string& name) {
+    if(name == "off") { return HttpConn::ADMIN_OFF; }
+    if(name == "all") { return HttpConn::ADMIN_ALL; }
+    return HttpConn::ADMIN_LOCAL;
+}
+
+Log::LogQueue::POLICY WebServer::LogOverflow_(const string& name) {
+    if(name == "drop_oldest") { return Log::LogQueue::DROP_OLDEST; }
+    if(name == "sample") { return Log::LogQueue::SAMPLE; }
+    if(name == "block") { return Log::LogQueue::BLOCK; }
+    return Log::LogQueue::DROP_NEWEST;
+}
+
+// 打开访问日志
+bool WebServer::InitAccessLog_() {
+    AccessLog::Options options;
+    options.path = config_.accessLog;
+    options.format = config_.accessLogFormat == "json" ? AccessLog::JSON : AccessLog::COMMON;
+    options.sample = config_.accessLogSample;
+    options.maxBytes = static_cast<long long>(config_.accessLogMaxMb) * 1024 * 1024;
+    options.rotateSec = config_.accessLogRotateSec;
+    options.flushMs = config_.accessLogFlushMs;
+    if(!AccessLog::Instance()->Init(options)) {
+        LOG_ERROR("Open access log %s error: %d", config_.accessLog.c_str(), errno);
+        return false;
+    }
+    return true;
+}
+
+// 文件缓存默认靠inotify失效，inotify用不了时退回到定时重新打开
+bool WebServer::InitFileCache_() {
+    FileCache* cache = FileCache::Instance();
+    cache->Init(config_.fileCache, config_.fileCacheRevalidateMs);
+    if((config_.fileCache == 0 && !config_.preload) || !config_.fileCacheInotify) { return true; }
+    cacheFd_ = cache->Watch(srcDir_);
+    if(cacheFd_ < 0) {
+        LOG_WARN("Watch %s error: %d, revalidate cached files every %dms", srcDir_.c_str(), errno,
+                    CACHE_REVALIDATE_MS);
+        if(config_.fileCacheRevalidateMs == 0) { cache->SetRevalidateMs(CACHE_REVALIDATE_MS); }
+        return true;
+    }
+    if(!epoller_->AddFd(cacheFd_, EPOLLIN)) {
+        LOG_ERROR("Add file cache inotify error!");
+        return false;
+    }
+    return true;
+}
+
+// 第一次同步建好再开始服务；镜像建不出来时照样启动，全部走磁盘
+bool WebServer::InitPreload_() {
+    if(!config_.preload) { return true; }
+    StaticImage::Options options;
+    options.maxBytes = static_cast<size_t>(config_.preloadMaxMb) << 20;
+    options.maxFileBytes = static_cast<size_t>(config_.preloadMaxFileKb) << 10;
+    if(!ImageBuilder::Instance()->Start(srcDir_, options)) {
+        LOG_WARN("Preload %s error, serve static files from disk", srcDir_.c_str());
+    }
+    if(cacheFd_ < 0) {
+        LOG_WARN("Preload without inotify, the image is only rebuilt on SIGHUP");
+    }
+    return true;
+}
+
+vector<int> WebServer::CpuList_(const string& spec) {
+    vector<int> cpus;
+    CpuAffinity::ParseCpuList(spec, &cpus);
+    return cpus;
+}
+
+AdmissionControl::Limits WebServer::AdmissionLimits_(const Config& config) {
+    AdmissionControl::Limits limits;
+    limits.maxQueue = config.maxQueue;
+    limits.maxInflight = config.maxInflight;
+    limits.maxLoopLagMs = config.maxLoopLagMs;
+    limits.maxConnPerIp = config.maxConnPerIp;
+    limits.mode = config.overloadMode == "pause" ? AdmissionControl::PAUSE : AdmissionControl::SHED;
+    return limits;
+}
+
+// 注册线程池、连接数和过载保护相关的统计，只有访问统计路径时才会去读
+void WebServer::RegisterMetrics_() {
+    Metrics* m = Metrics::Instance();
+    m->Register("webserver_pool_queue_depth", "gauge", "Tasks waiting in the thread pool.",
+                [this] { return static_cast<double>(threadpool_->QueueSize()); });
+    m->Register("webserver_inflight", "gauge", "Read/write tasks dispatched and not finished.",
+                [this] { return static_cast<double>(inflight_.load()); });
+    m->Register("webserver_connections", "gauge", "Open client connections.",
+                [] { return static_cast<double>(HttpConn::userCount.load()); });
+    m->Register("webserver_buffer_bytes", "gauge", "Memory held by all read/write buffers.",
+                [] { return static_cast<double>(Buffer::TotalBytes()); });
+    m->Register("webserver_loop_lag_ms", "gauge", "Smoothed event loop processing time.",
+                [this] { return static_cast<double>(loopLagMs_.load(std::memory_order_relaxed)); });
+    m->Register("webserver_file_cache_hits_total", "counter", "Static file lookups served from the file cache.",
+                [] { return static_cast<double>(FileCache::Instance()->Hits()); });
+    m->Register("webserver_file_cache_misses_total", "counter", "Static file lookups that had to open the file.",
+                [] { return static_cast<double>(FileCache::Instance()->Misses()); });
+    m->Register("webserver_file_cache_entries", "gauge", "Paths in the file cache.",
+                [] { return static_cast<double>(FileCache::Instance()->Size()); });
+    m->Register("webserver_preload_files", "gauge", "Files in the preloaded static image.",
+                [] {
+                    const shared_ptr<const StaticImage>& image = StaticImage::Current();
+                    return static_cast<double>(image ? image->Files() : 0);
+                });
+    m->Register("webserver_preload_bytes", "gauge", "Size of the preloaded static image.",
+                [] {
+                    const shared_ptr<const StaticImage>& image = StaticImage::Current();
+                    return static_cast<double>(image ? image->Bytes() : 0);
+                });
+    m->Register("webserver_preload_rebuilds_total", "counter", "Background rebuilds of the static image.",
+                [] { return static_cast<double>(ImageBuilder::Instance()->Rebuilds()); });
+    m->Register("webserver_log_dropped_total", "counter", "Log lines dropped because the async queue was full.",
+                [] { return static_cast<double>(Log::Instance()->Dropped()); });
+    m->Register("webserver_access_log_bytes_total", "counter", "Bytes written to the access log.",
+                [] { return static_cast<double>(AccessLog::Instance()->Written()); });
+    m->Register("webserver_access_log_dropped_bytes_total", "counter", "Access log bytes dropped because the writer fell behind.",
+                [] { return static_cast<double>(AccessLog::Instance()->Dropped()); });
+    const AdmissionControl::Stats& st = admission_.GetStats();
+    m->Register("webserver_reject_full_total", "counter", "Connections rejected at MAX_FD.",
+                [&st] { return static_cast<double>(st.rejectFull.load()); });
+    m->Register("webserver_reject_per_ip_total", "counter", "Connections rejected by the per-IP cap.",
+                [&st] { return static_cast<double>(st.rejectPerIp.load()); });
+    m->Register("webserver_reject_overload_total", "counter", "Connections shed under overload.",
+                [&st] { return static_cast<double>(st.rejectOverload.load()); });
+    m->Register("webserver_accept_pauses_total", "counter", "Times accepting was paused under overload.",
+                [&st] { return static_cast<double>(st.pauses.load()); });
+}
+
 //设置监听的文件描述符和通信的文件描述符的模式
 void WebServer::InitEventMode_(int trigMode) {
     listenEvent_ = EPOLLRDHUP;  //检测对方是否调用了close，调用close会触发EPOLLRDHUP事件
@@ -90,14 +277,45 @@ void WebServer::Start() {
         if(timeoutMS_ > 0) {
             timeMS = timer_->GetNextTick();
         }
+        if(draining_) {
+            if(DrainDone_()) { break; }
+            // 排空期间要定时醒来看看连接有没有处理完
+            if(timeMS < 0 || timeMS > DRAIN_CHECK_MS) {
+                timeMS = DRAIN_CHECK_MS;
+            }
+        }
+        else if(acceptPaused_) {
+            ResumeAccept_();
+            // 暂停accept期间要定时醒来看看负载有没有降下来
+            if(acceptPaused_ && (timeMS < 0 || timeMS > ACCEPT_RETRY_MS)) {
+                timeMS = ACCEPT_RETRY_MS;
+            }
+        }
         // 用epoll_wait检测
         int eventCnt = epoller_->Wait(timeMS);
+        TimeStamp begin = Clock::now();
         for(int i = 0; i < eventCnt; i++) {
             /* 处理事件 */
             int fd = epoller_->GetEventFd(i);
             uint32_t events = epoller_->GetEvents(i);
-            if(fd == listenFd_) {
-                DealListen_();  // 处理监听的操作，接受客户端
+            if(IsListenFd_(fd)) {
+                DealListen_(fd);  // 处理监听的操作，接受客户端
+            }
+            else if(fd == sigPipe_[0]) {
+                DealSignal_();  // 处理信号
+            }
+            else if(fd == handoffFd_) {
+                DealHandoff_(); // 新进程来接管监听套接字
+            }
+            else if(fd == cacheFd_) {
+                // 资源目录里的文件变了
+                if(FileCache::Instance()->DealEvents() && config_.preload) {
+                    ImageBuilder::Instance()->Invalidate();
+                }
+            }
+            else if(users_.count(fd) == 0) {
+                // 同一轮里已经被关掉的监听套接字或控制套接字上残留的事件
+                continue;
             }
             // 出现了错误
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
@@ -117,72 +335,319 @@ void WebServer::Start() {
                 LOG_ERROR("Unexpected event");
             }
         }
+        UpdateLoopLag_(begin);
     }
 }
-// 发送错误信息
-void WebServer::SendError_(int fd, const char*info) {
-    assert(fd > 0);
-    int ret = send(fd, info, strlen(info), 0);
-    if(ret < 0) {
-        LOG_WARN("send error to client[%d] error!", fd);
+
+// 信号处理函数里只做异步信号安全的事情：把信号值写进管道，交给主线程处理
+void WebServer::SigHandler_(int sig) {
+    int saveErrno = errno;
+    char msg = static_cast<char>(sig);
+    if(write(sigPipe_[1], &msg, 1) < 0) {}
+    errno = saveErrno;
+}
+
+// 用管道把信号转成epoll上的读事件，不管信号落到哪个线程上都能由主线程处理
+bool WebServer::InitSignal_() {
+    if(pipe2(sigPipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+        LOG_ERROR("Create signal pipe error!");
+        return false;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SigHandler_;
+    sa.sa_flags = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGHUP, &sa, nullptr);
+    // 对端关闭后再写会产生SIGPIPE，默认会终止进程
+    signal(SIGPIPE, SIG_IGN);
+    if(!epoller_->AddFd(sigPipe_[0], EPOLLIN)) {
+        LOG_ERROR("Add signal pipe error!");
+        return false;
+    }
+    return true;
+}
+
+// 创建控制套接字，新进程连上来的时候把监听套接字交给它
+bool WebServer::InitHandoff_() {
+    if(handoffPath_.empty()) { return true; }
+    handoffFd_ = ListenHandoff::CreateServer(handoffPath_.c_str());
+    if(handoffFd_ < 0) {
+        LOG_ERROR("Create handoff socket %s error!", handoffPath_.c_str());
+        return false;
+    }
+    if(!epoller_->AddFd(handoffFd_, EPOLLIN)) {
+        LOG_ERROR("Add handoff socket error!");
+        return false;
+    }
+    return true;
+}
+
+// 主线程就是事件循环线程，连接对象和读缓冲区大多在这里分配，numaLocal时让它们落在本地节点上
+bool WebServer::InitAffinity_() {
+    if(config_.openLog && !Log::Instance()->PinWriter(CpuList_(config_.logCpus))) {
+        LOG_WARN("Pin log writer to cpus %s error!", config_.logCpus.c_str());
+    }
+    if(!AccessLog::Instance()->PinWriter(CpuList_(config_.logCpus))) {
+        LOG_WARN("Pin access log writer to cpus %s error!", config_.logCpus.c_str());
+    }
+    vector<int> cpus = CpuList_(config_.loopCpus);
+    if(cpus.empty()) { return true; }
+    if(!CpuAffinity::PinSelf(cpus)) {
+        LOG_ERROR("Pin event loop to cpus %s error!", config_.loopCpus.c_str());
+        return false;
+    }
+    LOG_INFO("Event loop pinned to cpus %s, workers: %s, log writer: %s", config_.loopCpus.c_str(),
+                config_.workerCpus.empty() ? "none" : config_.workerCpus.c_str(),
+                config_.logCpus.empty() ? "none" : config_.logCpus.c_str());
+    if(config_.numaLocal) {
+        int node = CpuAffinity::NodeOfCpu(cpus[0]);
+        if(!CpuAffinity::PreferNode(node)) { LOG_WARN("Prefer NUMA node %d error!", node); }
+        else { LOG_INFO("Event loop prefers NUMA node %d", node); }
+    }
+    return true;
+}
+
+// SIGTERM/SIGINT优雅退出，SIGHUP重新加载配置
+void WebServer::DealSignal_() {
+    char sigs[64];
+    ssize_t n = read(sigPipe_[0], sigs, sizeof(sigs));
+    for(ssize_t i = 0; i < n; i++) {
+        switch(sigs[i]) {
+        case SIGTERM:
+        case SIGINT:
+            LOG_INFO("Receive signal %d, draining", sigs[i]);
+            StartDrain_();
+            break;
+        case SIGHUP:
+            LOG_INFO("Receive SIGHUP, reload");
+            Reload_();
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// 新进程连到控制套接字上，把监听套接字发过去，然后自己开始排空
+void WebServer::DealHandoff_() {
+    int fd = accept4(handoffFd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if(fd < 0) { return; }
+    if(listenFds_.empty() || !ListenHandoff::SendFds(fd, listenFds_)) {
+        LOG_ERROR("Handoff listen socket error!");
+        close(fd);
+        return;
     }
     close(fd);
+    LOG_INFO("%zu listen sockets handed off, draining", listenFds_.size());
+    // 控制套接字的路径已经归新进程了，不能再删
+    epoller_->DelFd(handoffFd_);
+    close(handoffFd_);
+    handoffFd_ = -1;
+    StartDrain_();
+}
+
+// 重新读配置文件，能在运行时生效的参数直接应用，其他的只提示需要重启
+void WebServer::Reload_() {
+    Config next = config_;
+    string err;
+    if(!next.Reload(&err)) {
+        LOG_ERROR("Reload config error: %s", err.c_str());
+        return;
+    }
+    // 超时从0变成非0时已有的连接没有定时器，这种情况也要重启
+    if((next.timeoutMs > 0) != (config_.timeoutMs > 0)) {
+        LOG_WARN("Reload: enabling or disabling timeout_ms needs a restart");
+        next.timeoutMs = config_.timeoutMs;
+    }
+    // 参数表里标了能在运行时生效的才拷过来，其他的只提示
+    vector<string> restart;
+    config_.ApplyLive(next, &restart);
+    if(!restart.empty()) {
+        string keys;
+        for(auto& key: restart) { keys += (keys.empty() ? "" : ", ") + key; }
+        LOG_WARN("Reload: %s changed, need a restart", keys.c_str());
+    }
+    timeoutMS_ = config_.timeoutMs;
+    Trace::Instance()->SetEnabled(config_.trace);
+    // 没有inotify时不能关掉重新打开，否则改过的文件一直不会失效
+    FileCache::Instance()->SetRevalidateMs(cacheFd_ < 0 && config_.fileCacheRevalidateMs == 0 ?
+                                           CACHE_REVALIDATE_MS : config_.fileCacheRevalidateMs);
+    // 没有inotify时只有这里会更新镜像，有inotify时也顺便把漏掉的变化补上
+    if(config_.preload) { ImageBuilder::Instance()->Rebuild(); }
+    if(config_.openLog) { Log::Instance()->SetLevel(config_.logLevel); }
+    admission_.SetLimits(AdmissionLimits_(config_));
+    LOG_INFO("Reload done, logLevel:%d, timeout:%dms, maxQueue:%d, maxInflight:%d, maxLoopLag:%dms, mode:%s, trace:%s",
+                config_.logLevel, timeoutMS_, config_.maxQueue, config_.maxInflight, config_.maxLoopLagMs,
+                config_.overloadMode.c_str(), config_.trace ? "on" : "off");
+}
+
+// 停止accept，已有的连接处理完当前的请求后就关闭，空闲的连接很快超时
+void WebServer::StartDrain_() {
+    if(draining_) { return; }
+    draining_ = true;
+    drainDeadline_ = Clock::now() + MS(config_.drainTimeoutMs);
+    HttpConn::isDraining = true;
+    for(int fd: listenFds_) {
+        epoller_->DelFd(fd);
+        close(fd);
+    }
+    listenFds_.clear();
+    if(timeoutMS_ > 0) {
+        for(auto& item: users_) {
+            if(item.second.GetFd() >= 0 && !item.second.IsClosed()) {
+                timer_->adjust(item.first, DRAIN_IDLE_MS);
+            }
+        }
+    }
+    LOG_INFO("Drain start, userCount:%d, inflight:%d", (int)HttpConn::userCount, (int)inflight_);
+}
+
+// 所有连接都关闭并且线程池里没有任务了，或者超时了，就可以退出了
+bool WebServer::DrainDone_() {
+    if(HttpConn::userCount <= 0 && inflight_ <= 0) {
+        LOG_INFO("Drain done");
+        return true;
+    }
+    if(Clock::now() >= drainDeadline_) {
+        LOG_WARN("Drain timeout, userCount:%d, inflight:%d", (int)HttpConn::userCount, (int)inflight_);
+        return true;
+    }
+    return false;
+}
+
+// 记录一轮事件处理的耗时，新值更大就直接取新值，否则慢慢衰减
+void WebServer::UpdateLoopLag_(const TimeStamp& begin) {
+    int cost = std::chrono::duration_cast<MS>(Clock::now() - begin).count();
+    int lag = std::max(cost, loopLagMs_.load(std::memory_order_relaxed) * 7 / 8);
+    loopLagMs_.store(lag, std::memory_order_relaxed);
+}
+
+// 过载时暂停监听新连接，新连接留在内核的全连接队列里
+void WebServer::PauseAccept_() {
+    if(acceptPaused_) { return; }
+    for(int fd: listenFds_) { epoller_->ModFd(fd, listenEvent_); }
+    acceptPaused_ = true;
+    admission_.OnPause();
+    LOG_WARN("Server overload, pause accept! queue:%zu, inflight:%d, loopLag:%dms",
+                threadpool_->QueueSize(), (int)inflight_, loopLagMs_.load(std::memory_order_relaxed));
+}
+
+// 负载降下来后恢复监听
+void WebServer::ResumeAccept_() {
+    if(admission_.Overloaded(threadpool_->QueueSize(), inflight_, loopLagMs_.load(std::memory_order_relaxed))) { return; }
+    for(int fd: listenFds_) { epoller_->ModFd(fd, listenEvent_ | EPOLLIN); }
+    acceptPaused_ = false;
+    LOG_INFO("Server resume accept");
 }
 // 关闭连接
 void WebServer::CloseConn_(HttpConn* client) {
     assert(client);
     LOG_INFO("Client[%d] quit!", client->GetFd());
     epoller_->DelFd(client->GetFd());
-    client->Close();
+    // 键要在关闭fd之前取，关闭以后主线程可能马上accept到复用这个fd的连接，init会改写对端地址
+    uint64_t key = client->GetPeer().Key();
+    // 只有真正关闭fd的那一次才释放ip的名额，避免定时器和子线程重复关闭时多减；
+    // 子线程还在处理时由它在EndTask_里释放
+    if(client->Close()) {
+        admission_.Release(key);
+    }
+}
+
+void WebServer::EndTask_(HttpConn* client) {
+    uint64_t key = client->GetPeer().Key();
+    if(client->EndTask()) {
+        admission_.Release(key);
+    }
 }
 
-// 添加客户端fd进epoll和设置非阻塞
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
+// 添加客户端fd进epoll，fd在accept4时已经是非阻塞的了
+void WebServer::AddClient_(int fd, const sockaddr* addr, socklen_t len) {
     assert(fd > 0);
-    users_[fd].init(fd, addr);
+    users_[fd].init(fd, addr, len);
+    Metrics::Add(Metrics::ACCEPTS);
     if(timeoutMS_ > 0) {
         timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
     }
     // 添加进epollfd
     epoller_->AddFd(fd, EPOLLIN | connEvent_);
-    SetFdNonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
 }
 
 // 处理新来的连接
-void WebServer::DealListen_() {
-    // 客户端的ip和端口信息
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
-    do {
-        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
-        // 当没有客户端的时候，fd返回的是-1，这时候就会退出循环return了
-        if(fd <= 0) { return;}
-        else if(HttpConn::userCount >= MAX_FD) {
-            SendError_(fd, "Server busy!");
-            LOG_WARN("Clients is full!");
+// LT和ET都一次最多accept ACCEPT_BATCH个，连接风暴时事件循环也能及时处理已有连接的读写
+void WebServer::DealListen_(int listenFd) {
+    // 客户端的ip和端口信息，二进制保存，要打印时才格式化
+    struct sockaddr_storage addr;
+    for(int i = 0; i < ACCEPT_BATCH; i++) {
+        // 暂停模式下过载了就先不accept，让连接留在内核队列里
+        if(admission_.GetLimits().mode == AdmissionControl::PAUSE &&
+           admission_.Overloaded(threadpool_->QueueSize(), inflight_, loopLagMs_.load(std::memory_order_relaxed))) {
+            PauseAccept_();
             return;
         }
-        AddClient_(fd, addr);   // 添加客户端
-    } while(listenEvent_ & EPOLLET);
+        socklen_t len = sizeof(addr);
+        // 直接拿到非阻塞、exec时关闭的fd，省掉两次fcntl
+        int fd = accept4(listenFd, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            // 对方在accept之前就断开了，接着取下一个
+            if(errno == ECONNABORTED || errno == EINTR) { continue; }
+            // 当没有客户端的时候返回EAGAIN，其他的是fd用完之类的错误
+            if(errno != EAGAIN) { LOG_WARN("Accept error: %d", errno); }
+            return;
+        }
+        AdmissionControl::DECISION ret = admission_.Admit(PeerAddr::Key((struct sockaddr *)&addr),
+                    HttpConn::userCount, MAX_FD, threadpool_->QueueSize(), inflight_, loopLagMs_.load(std::memory_order_relaxed));
+        if(ret != AdmissionControl::ADMIT) {
+            // 预先生成好的503，非阻塞发送
+            AdmissionControl::SendBusy(fd);
+            if(ret == AdmissionControl::REJECT_FULL) { LOG_WARN("Clients is full!"); }
+            else if(ret == AdmissionControl::REJECT_PER_IP) { LOG_WARN("Clients of one ip is full!"); }
+            else { LOG_WARN("Server overload, reject client!"); }
+            continue;
+        }
+        AddClient_(fd, (struct sockaddr *)&addr, len);   // 添加客户端
+    }
+    // 一批取满了队列里可能还有连接，ET模式下不会再通知，重新设置一次让epoll再报告
+    if(listenEvent_ & EPOLLET) {
+        epoller_->ModFd(listenFd, listenEvent_ | EPOLLIN);
+    }
 }
 // 处理读事件
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
     ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
+    inflight_++;
+    // 打开trace时记下入队的时间，算在线程池队列里等了多久
+    uint64_t queuedNs = Trace::Enabled() ? Trace::NowNs() : 0;
+    client->BeginTask();
+    threadpool_->AddTask([this, client, queuedNs] {
+        if(queuedNs) { Trace::Record(Trace::QUEUE, client->GetFd(), queuedNs, Trace::NowNs()); }
+        OnRead_(client);
+        EndTask_(client);
+        inflight_--;
+    });
 }
 //  处理写事件
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
     // 调整超时时间
     ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    inflight_++;
+    uint64_t queuedNs = Trace::Enabled() ? Trace::NowNs() : 0;
+    client->BeginTask();
+    threadpool_->AddTask([this, client, queuedNs] {
+        if(queuedNs) { Trace::Record(Trace::QUEUE, client->GetFd(), queuedNs, Trace::NowNs()); }
+        OnWrite_(client);
+        EndTask_(client);
+        inflight_--;
+    });
 }
 // 调整当前客户端连接的定时器时间
 void WebServer::ExtentTime_(HttpConn* client) {
     assert(client);
-    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), draining_ ? DRAIN_IDLE_MS : timeoutMS_); }
 }
 
 // 这个方法是在子线程中执行的，真正处理读的事件
@@ -233,18 +698,68 @@ void WebServer::OnWrite_(HttpConn* client) {
     CloseConn_(client);
 }
 
-// 初始化套接字
+// 初始化套接字，配置里的每个地址一个监听套接字
 bool WebServer::InitSocket_() {
-    int ret;
-    struct sockaddr_in addr;
-    if(port_ > 65535 || port_ < 1024) {
-        LOG_ERROR("Port:%d error!",  port_);
+    vector<ListenAddr> addrs;
+    string err;
+    if(!ListenAddr::ParseList(config_.listen, port_, &addrs, &err)) {
+        LOG_ERROR("%s", err.c_str());
         return false;
     }
-    addr.sin_family = AF_INET;
-    // inet_pton(AF_INET, ip, &addr.sin_addr);
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port_);
+    vector<int> inherited;
+    if(takeover_ && !handoffPath_.empty()) {
+        // 从旧进程接管监听套接字，不用重新bind，中间不会有拒绝连接的空档
+        inherited = ListenHandoff::Takeover(handoffPath_.c_str());
+        if(inherited.empty()) {
+            LOG_WARN("No server to take over at %s, bind a new socket", handoffPath_.c_str());
+        }
+    }
+    bool ok = true;
+    for(auto& addr: addrs) {
+        int fd = -1;
+        // 按绑定的地址对应，旧进程没有的地址重新bind
+        for(auto& inheritFd: inherited) {
+            if(inheritFd >= 0 && addr.BoundTo(inheritFd)) {
+                fd = inheritFd;
+                inheritFd = -1;
+                break;
+            }
+        }
+        if(fd >= 0) {
+            SetFdNonblock(fd);
+            // 旧进程的参数可能和这次的配置不一样，重新设置一遍
+            if(!InitSockOpts_(fd)) {
+                close(fd);
+                ok = false;
+                break;
+            }
+            LOG_INFO("Take over listen socket %s from %s", addr.text.c_str(), handoffPath_.c_str());
+        } else {
+            fd = OpenListener_(addr);
+            if(fd < 0) {
+                ok = false;
+                break;
+            }
+        }
+        if(!epoller_->AddFd(fd, listenEvent_ | EPOLLIN)) {
+            LOG_ERROR("Add listen error!");
+            close(fd);
+            ok = false;
+            break;
+        }
+        listenFds_.push_back(fd);
+        LOG_INFO("Server listen on %s", addr.text.c_str());
+    }
+    // 配置里已经没有的地址不再监听
+    for(int fd: inherited) {
+        if(fd >= 0) { close(fd); }
+    }
+    return ok;
+}
+
+// 创建一个监听套接字，bind到addr上
+int WebServer::OpenListener_(const ListenAddr& addr) {
+    int ret;
     struct linger optLinger = { 0 };
     if(openLinger_) {
         /* 优雅关闭: 直到所剩数据发送完毕或超时 */
@@ -252,50 +767,101 @@ bool WebServer::InitSocket_() {
         optLinger.l_linger = 1;
     }
 
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if(listenFd_ < 0) {
-        LOG_ERROR("Create socket error!", port_);
-        return false;
+    int fd = socket(addr.Family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        LOG_ERROR("Create socket %s error!", addr.text.c_str());
+        return -1;
     }
 
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    ret = setsockopt(fd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
     if(ret < 0) {
-        close(listenFd_);
-        LOG_ERROR("Init linger error!", port_);
-        return false;
+        close(fd);
+        LOG_ERROR("Init linger error!");
+        return -1;
     }
 
     int optval = 1;
     /* 端口复用 */
     /* 只有最后一个套接字会正常接收数据。 */
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if(ret == -1) {
         LOG_ERROR("set socket setsockopt error !");
-        close(listenFd_);
-        return false;
+        close(fd);
+        return -1;
     }
 
-    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
+    // 双栈时IPv4的客户端也从这个套接字进来，地址是::ffff:a.b.c.d
+    if(addr.Family() == AF_INET6) {
+        optval = config_.ipv6Only ? 1 : 0;
+        if(setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval, sizeof(optval)) < 0) {
+            LOG_ERROR("Set IPV6_V6ONLY error!");
+            close(fd);
+            return -1;
+        }
+    }
+
+    // 缓冲区大小要在listen之前设置，窗口扩大因子是握手时协商的
+    if(!InitSockOpts_(fd)) {
+        close(fd);
+        return -1;
+    }
+
+    ret = bind(fd, (const struct sockaddr *)&addr.addr, addr.len);
     if(ret < 0) {
-        LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
-        return false;
+        LOG_ERROR("Bind %s error: %d%s", addr.text.c_str(), errno,
+                    errno == EADDRINUSE && addr.Family() == AF_INET6 && !config_.ipv6Only ?
+                    ", set ipv6_only to listen on the same port with IPv4" : "");
+        close(fd);
+        return -1;
     }
 
-    ret = listen(listenFd_, 6);
+    ret = listen(fd, config_.backlog);
     if(ret < 0) {
-        LOG_ERROR("Listen port:%d error!", port_);
-        close(listenFd_);
+        LOG_ERROR("Listen %s error!", addr.text.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 是不是监听套接字，一般只有一两个
+bool WebServer::IsListenFd_(int fd) const {
+    for(int listenFd: listenFds_) {
+        if(fd == listenFd) { return true; }
+    }
+    return false;
+}
+
+// 监听套接字上的TCP参数，accept出来的连接会继承TCP_NODELAY和收发缓冲区大小，
+// 不用每个连接再调一次setsockopt
+bool WebServer::InitSockOpts_(int fd) {
+    int optval = config_.tcpNoDelay ? 1 : 0;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) < 0) {
+        LOG_ERROR("Set TCP_NODELAY error: %d", errno);
+        return false;
+    }
+    // 为0时不设置，设置了就会关掉内核的自动调节
+    if(config_.sndBuf > 0 &&
+       setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &config_.sndBuf, sizeof(config_.sndBuf)) < 0) {
+        LOG_ERROR("Set SO_SNDBUF error: %d", errno);
+        return false;
+    }
+    if(config_.rcvBuf > 0 &&
+       setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &config_.rcvBuf, sizeof(config_.rcvBuf)) < 0) {
+        LOG_ERROR("Set SO_RCVBUF error: %d", errno);
         return false;
     }
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);
-    if(ret == 0) {
-        LOG_ERROR("Add listen error!");
-        close(listenFd_);
+    // 握手完成后等请求数据到了才放进全连接队列，空连接不会唤醒事件循环
+    optval = config_.deferAcceptSec;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &optval, sizeof(optval)) < 0) {
+        LOG_ERROR("Set TCP_DEFER_ACCEPT error: %d", errno);
         return false;
     }
-    SetFdNonblock(listenFd_);
-    LOG_INFO("Server port:%d", port_);
+    // 客户端带cookie重连时SYN里就能带上请求，省一个RTT
+    if(config_.fastOpen > 0 &&
+       setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &config_.fastOpen, sizeof(config_.fastOpen)) < 0) {
+        LOG_WARN("Set TCP_FASTOPEN error: %d, check net.ipv4.tcp_fastopen", errno);
+    }
     return true;
 }
 
@@ -7,60 +7,112 @@
 #define WEBSERVER_H
 
 #include <unordered_map>
+#include <string>
+#include <functional>
+#include <signal.h>
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
 #include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include "epoller.h"
+#include "admission.h"
+#include "handoff.h"
+#include "listenaddr.h"
 #include "../log/log.h"
+#include "../log/accesslog.h"
 #include "../timer/heaptimer.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
+#include "../pool/affinity.h"
 #include "../pool/sqlconnRAII.h"
 #include "../http/httpconn.h"
+#include "../http/filecache.h"
+#include "../http/staticimage.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
+#include "../config/config.h"
 
 class WebServer {
 public:
-    WebServer(
-        int port, int trigMode, int timeoutMS, bool OptLinger, 
-        int sqlPort, const char* sqlUser, const  char* sqlPwd, 
-        const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+    explicit WebServer(const Config& config);
 
     ~WebServer();
     void Start();
 
 private:
     bool InitSocket_();  // 初始化套接字
+    int OpenListener_(const ListenAddr& addr);  // 创建一个监听套接字，失败返回-1
+    bool IsListenFd_(int fd) const;  // 是不是监听套接字
+    bool InitSockOpts_(int fd);  // 按配置设置监听套接字的TCP参数
+    bool InitSignal_();  // 用管道把信号转成epoll上的读事件
+    bool InitHandoff_(); // 创建交接监听套接字用的控制套接字
+    bool InitAffinity_(); // 事件循环和日志写线程绑核
+    bool InitAccessLog_(); // 打开访问日志
+    bool InitFileCache_(); // 初始化文件缓存，监视资源目录的inotify放进epoll
+    bool InitPreload_();   // 把资源目录预加载成内存镜像
+    static Log::LogQueue::POLICY LogOverflow_(const std::string& name); // 配置里的名字转成队列策略
+    static HttpConn::ADMIN_ACCESS AdminAccess_(const std::string& name); // 配置里的名字转成管理路径的访问限制
     void InitEventMode_(int trigMode);   // 设置监听的文件描述符和通信的文件描述符的模式
-    void AddClient_(int fd, sockaddr_in addr);  // 添加客户端fd进epoll和设置非阻塞 
+    void RegisterMetrics_();  // 注册统计项
+    void AddClient_(int fd, const sockaddr* addr, socklen_t len);  // 添加客户端fd进epoll
   
-    void DealListen_();  // 处理新来的连接
+    void DealListen_(int listenFd);  // 处理新来的连接
+    void DealSignal_();  // 处理信号
+    void DealHandoff_(); // 新进程来接管监听套接字
+    void Reload_();      // SIGHUP时重新加载配置，只应用能在运行时修改的参数
+
+    void StartDrain_();  // 停止accept，等已有的连接处理完再退出
+    bool DrainDone_();   // 排空是否结束
     void DealWrite_(HttpConn* client);  // 有读事件到来时候
     void DealRead_(HttpConn* client);   //  有写事件到来时候
 
-    void SendError_(int fd, const char*info);  // 发送错误信息
+    void PauseAccept_();   // 过载时暂停监听新连接
+    void ResumeAccept_();  // 负载降下来后恢复监听
+    void UpdateLoopLag_(const TimeStamp& begin);  // 记录一轮事件处理的耗时
     void ExtentTime_(HttpConn* client); // 调整当前客户端连接的定时器时间
     void CloseConn_(HttpConn* client); // 关闭连接
+    void EndTask_(HttpConn* client);   // 子线程做完一个读写任务，任务期间连接被关闭了的话这时才真正关闭
 
     void OnRead_(HttpConn* client);   // 这个方法是在子线程中执行的，真正处理读的事件
     void OnWrite_(HttpConn* client);  // 这个方法是在子线程中执行的，真正处理写的事件
     void OnProcess(HttpConn* client); // 处理业务逻辑
 
     static const int MAX_FD = 65536;    // 最大的文件描述符的个数
+    static const int ACCEPT_RETRY_MS = 10;  // 暂停accept期间检查负载的间隔
+    static const int ACCEPT_BATCH = 64;     // 一次监听事件最多accept的连接数
+    static const int DRAIN_IDLE_MS = 1000;      // 排空期间空闲连接的超时时间
+    static const int DRAIN_CHECK_MS = 100;      // 排空期间检查是否结束的间隔
+    static const int CACHE_REVALIDATE_MS = 1000;    // inotify用不了时文件缓存重新打开的间隔
+
+    static void SigHandler_(int sig);   // 信号处理函数，只往管道里写信号值
     
-    static int SetFdNonblock(int fd);   // 设置文件描述符阻塞
+    static int SetFdNonblock(int fd);   // 设置文件描述符非阻塞，接管来的监听套接字用
+    static AdmissionControl::Limits AdmissionLimits_(const Config& config);  // 从配置生成过载保护的阈值
+    static std::vector<int> CpuList_(const std::string& spec);   // 解析CPU列表，配置已经校验过了
 
+    Config config_;  // 当前生效的配置
     int port_;       //端口
     bool openLinger_; //是否打开优雅关闭
     int timeoutMS_;  /* 毫秒MS */
     bool isClose_;   //是否关闭
-    int listenFd_;  // 监听的文件描述符
-    char* srcDir_;  // 资源的目录
+    bool acceptPaused_;  // 是否因为过载暂停了accept
+    std::atomic<int> loopLagMs_;  // 事件循环处理一轮事件的耗时，平滑过的，主线程写，生成统计的子线程也会读
+    std::atomic<int> inflight_;  // 已经交给线程池还没处理完的读写任务数
+    std::vector<int> listenFds_;  // 监听的文件描述符，每个监听地址一个
+    std::string srcDir_;  // 资源的目录
+
+    bool draining_;             // 是否正在排空连接
+    TimeStamp drainDeadline_;   // 排空的截止时间
+    std::string handoffPath_;   // 控制套接字的路径，为空表示不支持交接
+    bool takeover_;             // 启动时是否从旧进程接管监听套接字
+    int handoffFd_;             // 控制套接字
+    int cacheFd_;               // 文件缓存和预加载镜像监视资源目录的inotify，-1表示没有监视
+    static int sigPipe_[2];     // 信号处理函数写[1]，主线程在epoll里读[0]
     
     uint32_t listenEvent_;  // 监听的文件描述符的事件
     uint32_t connEvent_;    // 链接的文件描述符事件
@@ -68,6 +120,7 @@ private:
     std::unique_ptr<HeapTimer> timer_;          //定时器
     std::unique_ptr<ThreadPool> threadpool_;    // 线程池
     std::unique_ptr<Epoller> epoller_;          // epoll对象
+    AdmissionControl admission_;                // 过载保护
     std::unordered_map<int, HttpConn> users_;   // 保存的是客户端连接的信息
 };
 
@@ -4,17 +4,18 @@
  * @copyleft Apache 2.0
  */ 
 #include "heaptimer.h"
+#include "../metrics/metrics.h"
 
 void HeapTimer::siftup_(size_t i) {
     assert(i >= 0 && i < heap_.size());
-    // 父亲索引
-    size_t j = (i - 1) / 2;
-    while(j >= 0) {
+    // 到了堆顶就停，size_t的(0 - 1) / 2不是-1
+    while(i > 0) {
+        // 父亲索引
+        size_t j = (i - 1) / 2;
         if(heap_[j] < heap_[i]) { break; }
         // 如果当前节点比父亲节点小，就交换
         SwapNode_(i, j);
         i = j;
-        j = (i - 1) / 2;
     }
 }
 
@@ -119,6 +120,7 @@ void HeapTimer::tick() {
             break; 
         }
         // 超时了就要回调函数，就要关闭，就是CloseConn_()
+        Metrics::Add(Metrics::TIMER_EXPIRES);
         node.cb();
         pop();
     }
@@ -0,0 +1,29 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+// libFuzzer的入口，clang++ -fsanitize=fuzzer编译，见readme.md
+#include <stdio.h>
+#include <stdlib.h>
+#include "parsercheck.h"
+
+using namespace std;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    string input(reinterpret_cast<const char*>(data), size);
+    // 切分方式由输入本身决定，同一个输入每次跑的结果一样，崩溃可以复现
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < size; i++) { hash = (hash ^ data[i]) * 1099511628211ULL; }
+    const uint64_t seeds[] = { 0, 1, hash | 2, (hash + 1) | 2, (hash + 2) | 2, (hash + 3) | 2 };
+    string err;
+    for(uint64_t seed: seeds) {
+        // 逐字节切分的解析次数和输入长度的平方成正比，只对短输入做
+        if(seed == 1 && size > 4096) { continue; }
+        if(!CheckParser(input, seed, &err)) {
+            fprintf(stderr, "parser mismatch: %s\n", err.c_str());
+            abort();
+        }
+    }
+    return 0;
+}
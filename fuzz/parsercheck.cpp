@@ -0,0 +1,355 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+#include "parsercheck.h"
+
+#include <algorithm>
+#include <random>
+#include <ctype.h>
+#include <stdio.h>
+#include "../code/http/httprequest.h"
+
+using namespace std;
+
+namespace {
+
+string Lower(string str) {
+    for(char& ch: str) { ch = tolower(static_cast<unsigned char>(ch)); }
+    return str;
+}
+
+// 同名的请求头取第一个，名字不区分大小写
+const string* FindHeader(const ParsedRequest& req, const string& name) {
+    for(auto& field: req.headers) {
+        if(Lower(field.first) == name) { return &field.second; }
+    }
+    return nullptr;
+}
+
+// %XX解码，不合法的%原样保留
+string Decode(const string& str, bool plusAsSpace) {
+    string out;
+    size_t i = 0;
+    while(i < str.size()) {
+        if(plusAsSpace && str[i] == '+') {
+            out += ' ';
+            i++;
+        } else if(str[i] == '%' && i + 2 < str.size() &&
+                  isxdigit(static_cast<unsigned char>(str[i + 1])) &&
+                  isxdigit(static_cast<unsigned char>(str[i + 2]))) {
+            out += static_cast<char>(stoi(str.substr(i + 1, 2), nullptr, 16));
+            i += 3;
+        } else {
+            out += str[i++];
+        }
+    }
+    return out;
+}
+
+// 解码后按/切成段，处理.和..，不能越过根目录
+bool Normalize(const string& target, string* path) {
+    string decoded = Decode(target, false);
+    if(decoded.empty() || decoded[0] != '/' || decoded.find('\0') != string::npos) { return false; }
+    vector<string> segs;
+    bool dirSlash = false;
+    size_t begin = 1;
+    while(true) {
+        size_t slash = decoded.find('/', begin);
+        bool last = slash == string::npos;
+        string seg = decoded.substr(begin, last ? string::npos : slash - begin);
+        if(seg.empty() || seg == ".") {
+            dirSlash = true;
+        } else if(seg == "..") {
+            if(segs.empty()) { return false; }
+            segs.pop_back();
+            dirSlash = true;
+        } else {
+            segs.push_back(seg);
+            dirSlash = !last;
+        }
+        if(last) { break; }
+        begin = slash + 1;
+    }
+    path->clear();
+    for(auto& seg: segs) { *path += "/" + seg; }
+    if(segs.empty() || dirSlash) { *path += "/"; }
+    return true;
+}
+
+enum { INCOMPLETE, DONE, BAD };
+
+// 从pos开始取一行，去掉结尾的\r
+int NextLine(const string& in, size_t* pos, string* line) {
+    size_t nl = in.find('\n', *pos);
+    if(nl == string::npos) {
+        // 还差一个\n时最多可以有MAX_LINE加一个\r
+        return in.size() - *pos > HttpRequest::MAX_LINE + 1 ? BAD : INCOMPLETE;
+    }
+    *line = in.substr(*pos, nl - *pos);
+    *pos = nl + 1;
+    if(!line->empty() && line->back() == '\r') { line->pop_back(); }
+    return line->size() > HttpRequest::MAX_LINE ? BAD : DONE;
+}
+
+bool ParseRequestLine(const string& line, ParsedRequest* req) {
+    size_t sp1 = line.find(' ');
+    if(sp1 == string::npos) { return false; }
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if(sp2 == string::npos || line.substr(sp2 + 1, 5) != "HTTP/" ||
+       line.find(' ', sp2 + 1) != string::npos) {
+        return false;
+    }
+    req->method = line.substr(0, sp1);
+    req->version = line.substr(sp2 + 6);
+    string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    size_t mark = target.find('?');
+    if(mark != string::npos) {
+        req->query = target.substr(mark + 1);
+        target.resize(mark);
+    }
+    if(!Normalize(target, &req->path)) { return false; }
+    static const char* const DEFAULT_HTML[] = {
+        "/index", "/login", "/picture", "/register", "/video", "/welcome", };
+    if(req->path == "/") {
+        req->path = "/index.html";
+    } else if(find(begin(DEFAULT_HTML), end(DEFAULT_HTML), req->path) != end(DEFAULT_HTML)) {
+        req->path += ".html";
+    }
+    return true;
+}
+
+bool ParseHeader(const string& line, ParsedRequest* req) {
+    size_t colon = line.find(':');
+    if(colon == string::npos || colon == 0) { return false; }
+    if(req->headers.size() >= HttpRequest::MAX_HEADERS) { return false; }
+    string name = line.substr(0, colon);
+    string value = line.substr(colon + 1);
+    size_t first = value.find_first_not_of(" \t");
+    value = first == string::npos ? "" : value.substr(first, value.find_last_not_of(" \t") - first + 1);
+    string lower = Lower(name);
+    if((lower == "content-length" || lower == "transfer-encoding") && FindHeader(*req, lower)) {
+        return false;
+    }
+    req->headers.emplace_back(name, value);
+    return true;
+}
+
+void ParseForm(ParsedRequest* req) {
+    size_t begin = 0;
+    while(begin < req->body.size()) {
+        size_t amp = req->body.find('&', begin);
+        if(amp == string::npos) { amp = req->body.size(); }
+        string pair = req->body.substr(begin, amp - begin);
+        begin = amp + 1;
+        size_t eq = pair.find('=');
+        if(eq == string::npos || eq == 0) { continue; }
+        string key = Decode(pair.substr(0, eq), true);
+        bool seen = false;
+        for(auto& field: req->post) { seen = seen || field.first == key; }
+        if(!seen) { req->post.emplace_back(key, Decode(pair.substr(eq + 1), true)); }
+    }
+    int tag = req->path == "/login.html" ? 1 : req->path == "/register.html" ? 0 : -1;
+    if(tag < 0) { return; }
+    string name, pwd;
+    for(auto& field: req->post) {
+        if(field.first == "username" && name.empty()) { name = field.second; }
+        if(field.first == "password" && pwd.empty()) { pwd = field.second; }
+    }
+    req->path = FakeVerify(name, pwd, tag == 1) ? "/welcome.html" : "/error.html";
+}
+
+// 解析pos开始的一个请求
+int RefParseOne(const string& in, size_t* pos, ParsedRequest* req) {
+    string line;
+    int ret;
+    // 请求行前面的空行跳过
+    do {
+        ret = NextLine(in, pos, &line);
+        if(ret != DONE) { return ret; }
+    } while(line.empty());
+    if(!ParseRequestLine(line, req)) { return BAD; }
+    while(true) {
+        ret = NextLine(in, pos, &line);
+        if(ret != DONE) { return ret; }
+        if(line.empty()) { break; }
+        if(!ParseHeader(line, req)) { return BAD; }
+    }
+    if(FindHeader(*req, "transfer-encoding")) { return BAD; }
+    size_t len = 0;
+    if(const string* value = FindHeader(*req, "content-length")) {
+        if(value->empty() || value->find_first_not_of("0123456789") != string::npos) { return BAD; }
+        // 前导0去掉以后超过8位的一定超过MAX_BODY
+        string digits = value->substr(min(value->find_first_not_of('0'), value->size()));
+        if(digits.size() > 8) { return BAD; }
+        len = digits.empty() ? 0 : stoul(digits);
+    }
+    if(len > HttpRequest::MAX_BODY) { return BAD; }
+    if(len > 0) {
+        if(in.size() - *pos < len) { return INCOMPLETE; }
+        req->body = in.substr(*pos, len);
+        *pos += len;
+        const string* type = FindHeader(*req, "content-type");
+        if(req->method == "POST" && type && Lower(*type) == "application/x-www-form-urlencoded") {
+            ParseForm(req);
+            req->body.clear();
+        }
+    }
+    const string* conn = FindHeader(*req, "connection");
+    req->keepAlive = req->version == "1.1" && conn && Lower(*conn) == "keep-alive";
+    req->code = HttpRequest::GET_REQUEST;
+    return DONE;
+}
+
+string Quote(const string& str) {
+    string out = "\"";
+    for(unsigned char ch: str) {
+        if(ch >= 0x20 && ch < 0x7f && ch != '"' && ch != '\\') {
+            out += ch;
+        } else {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\x%02x", ch);
+            out += buf;
+        }
+        if(out.size() > 80) {
+            out += "...";
+            break;
+        }
+    }
+    return out + "\"";
+}
+
+// 比较两个请求，返回第一个不同的字段
+string Diff(const ParsedRequest& got, const ParsedRequest& want) {
+    if(got.code != want.code) {
+        return "code " + to_string(got.code) + " != " + to_string(want.code);
+    }
+    if(got.code != HttpRequest::GET_REQUEST) { return ""; }
+    const pair<const char*, const string ParsedRequest::*> fields[] = {
+        {"method", &ParsedRequest::method}, {"path", &ParsedRequest::path},
+        {"query", &ParsedRequest::query}, {"version", &ParsedRequest::version},
+        {"body", &ParsedRequest::body},
+    };
+    for(auto& field: fields) {
+        if(got.*field.second != want.*field.second) {
+            return string(field.first) + " " + Quote(got.*field.second) + " != " + Quote(want.*field.second);
+        }
+    }
+    if(got.headers != want.headers) {
+        return "headers differ, " + to_string(got.headers.size()) + " vs " + to_string(want.headers.size());
+    }
+    if(got.post != want.post) {
+        return "form fields differ, " + to_string(got.post.size()) + " vs " + to_string(want.post.size());
+    }
+    if(got.keepAlive != want.keepAlive) { return "keep-alive differs"; }
+    return "";
+}
+
+bool IsForm(const HttpRequest& request) {
+    return request.method() == "POST" && HeaderMap::EqualsIgnoreCase(
+        request.Headers().Get(HeaderMap::CONTENT_TYPE), "application/x-www-form-urlencoded");
+}
+
+} // namespace
+
+bool FakeVerify(string_view name, string_view pwd, bool isLogin) {
+    if(name.empty() || pwd.empty()) { return false; }
+    return isLogin ? name == pwd : name != "taken";
+}
+
+vector<ParsedRequest> RefParse(const string& input) {
+    vector<ParsedRequest> out;
+    size_t pos = 0;
+    // 和HttpConn一样，缓冲区里没有数据时不再解析
+    while(pos < input.size()) {
+        ParsedRequest req;
+        int ret = RefParseOne(input, &pos, &req);
+        if(ret == INCOMPLETE) { break; }
+        if(ret == BAD) {
+            ParsedRequest bad;
+            bad.code = HttpRequest::BAD_REQUEST;
+            out.push_back(bad);
+            break;
+        }
+        out.push_back(std::move(req));
+    }
+    return out;
+}
+
+vector<ParsedRequest> SplitParse(const string& input, const vector<size_t>& cuts) {
+    HttpRequest::SetVerifier(FakeVerify);
+    vector<ParsedRequest> out;
+    Arena arena;
+    HttpRequest request(&arena);
+    Buffer buff;
+    size_t begin = 0;
+    for(size_t i = 0; i <= cuts.size(); i++) {
+        size_t end = i < cuts.size() ? cuts[i] : input.size();
+        buff.Append(input.data() + begin, end - begin);
+        begin = end;
+        while(buff.ReadableBytes() > 0) {
+            HttpRequest::HTTP_CODE ret = request.parse(buff);
+            if(ret == HttpRequest::NO_REQUEST) { break; }
+            ParsedRequest req;
+            req.code = ret;
+            if(ret != HttpRequest::GET_REQUEST) {
+                // 出错以后连接就关了，后面的数据不再解析
+                out.push_back(req);
+                return out;
+            }
+            req.method = string(request.method());
+            req.path = string(request.path());
+            req.query = string(request.query());
+            req.version = string(request.version());
+            if(!IsForm(request)) { req.body = string(request.body()); }
+            const HeaderMap& headers = request.Headers();
+            for(size_t j = 0; j < headers.Size(); j++) {
+                req.headers.emplace_back(string(headers.At(j).first), string(headers.At(j).second));
+            }
+            for(auto& field: request.Post()) {
+                req.post.emplace_back(string(field.first), string(field.second));
+            }
+            req.keepAlive = request.IsKeepAlive();
+            out.push_back(std::move(req));
+        }
+    }
+    return out;
+}
+
+vector<size_t> MakeCuts(size_t size, uint64_t seed) {
+    vector<size_t> cuts;
+    if(size < 2 || seed == 0) { return cuts; }
+    if(seed == 1) {
+        for(size_t i = 1; i < size; i++) { cuts.push_back(i); }
+        return cuts;
+    }
+    // mt19937_64的输出是标准规定的，不同平台上同一个seed切出来一样
+    mt19937_64 rng(seed);
+    size_t n = 1 + rng() % 16;
+    for(size_t i = 0; i < n; i++) { cuts.push_back(1 + rng() % (size - 1)); }
+    sort(cuts.begin(), cuts.end());
+    cuts.erase(unique(cuts.begin(), cuts.end()), cuts.end());
+    return cuts;
+}
+
+bool CheckParser(const string& input, uint64_t seed, string* err) {
+    vector<ParsedRequest> want = RefParse(input);
+    vector<size_t> cuts = MakeCuts(input.size(), seed);
+    vector<ParsedRequest> got = SplitParse(input, cuts);
+    string diff;
+    size_t i = 0;
+    for(; i < got.size() && i < want.size(); i++) {
+        diff = Diff(got[i], want[i]);
+        if(!diff.empty()) { break; }
+    }
+    if(diff.empty() && got.size() != want.size()) {
+        diff = to_string(got.size()) + " requests parsed, reference has " + to_string(want.size());
+    }
+    if(diff.empty()) { return true; }
+    string where;
+    for(size_t j = 0; j < cuts.size() && j < 16; j++) { where += (j ? "," : "") + to_string(cuts[j]); }
+    if(cuts.size() > 16) { where += ",..."; }
+    *err = "seed " + to_string(seed) + " cuts [" + where + "] request #" + to_string(i) + ": " + diff;
+    return false;
+}
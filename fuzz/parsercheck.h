@@ -0,0 +1,43 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-26
+ * @copyleft Apache 2.0
+ */
+#ifndef PARSER_CHECK_H
+#define PARSER_CHECK_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+// HttpRequest::parse的差分测试：同一段输入按不同位置切成几段，一段一段追加到Buffer里解析，
+// 得到的请求序列必须和参考实现一次性解析整段输入的结果完全一样。
+// 参考实现只求简单直接，不考虑性能，解析器做优化时拿它当对照。
+
+// 解析出来的一个请求，BAD_REQUEST时只有code有意义；表单请求的body被原地解码了，只比较post
+struct ParsedRequest {
+    int code = 0;           // HttpRequest::GET_REQUEST或者BAD_REQUEST
+    std::string method, path, query, version, body;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::vector<std::pair<std::string, std::string>> post;     // 表单，同名的只留第一个
+    bool keepAlive = false;
+};
+
+// 测试里用的用户验证，不访问数据库：登录要求用户名和密码相同，注册要求用户名不是taken
+bool FakeVerify(std::string_view name, std::string_view pwd, bool isLogin);
+
+// 参考实现，整段输入一次解析完，最后不完整的请求不算，遇到错误的请求就停下
+std::vector<ParsedRequest> RefParse(const std::string& input);
+
+// 按cuts里的位置(递增)切开input，每追加一段就像HttpConn::process那样把能解析的请求都解析出来
+std::vector<ParsedRequest> SplitParse(const std::string& input, const std::vector<size_t>& cuts);
+
+// 由seed确定的切分方式：0不切，1每个字节一段，其他随机切1~16刀
+std::vector<size_t> MakeCuts(size_t size, uint64_t seed);
+
+// 比较seed对应的切分方式和参考实现的结果，不一致时把第一个不同写进err
+bool CheckParser(const std::string& input, uint64_t seed, std::string* err);
+
+#endif //PARSER_CHECK_H